@@ -0,0 +1,71 @@
+#include "AllocationCounter.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+    std::atomic<long long> allocations(0);
+    // constant-initialized, so reading it from inside operator new allocates nothing
+    thread_local long long threadAllocations = 0;
+
+    void* Allocate(std::size_t size)
+    {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        ++threadAllocations;
+        void* p = std::malloc(size ? size : 1);
+        if (!p) {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+
+    void* AllocateAligned(std::size_t size, std::align_val_t align)
+    {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        ++threadAllocations;
+        const std::size_t alignment = static_cast<std::size_t>(align);
+#ifdef _WIN32
+        void* p = _aligned_malloc(size ? size : 1, alignment);
+#else
+        // aligned_alloc wants the size to be a multiple of the alignment
+        void* p = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+#endif
+        if (!p) {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+
+    void FreeAligned(void* p)
+    {
+#ifdef _WIN32
+        _aligned_free(p);
+#else
+        std::free(p);
+#endif
+    }
+}
+
+long long AllocationCount()
+{
+    return allocations.load(std::memory_order_relaxed);
+}
+
+long long ThreadAllocationCount()
+{
+    return threadAllocations;
+}
+
+void* operator new(std::size_t size) { return Allocate(size); }
+void* operator new[](std::size_t size) { return Allocate(size); }
+void* operator new(std::size_t size, std::align_val_t align) { return AllocateAligned(size, align); }
+void* operator new[](std::size_t size, std::align_val_t align) { return AllocateAligned(size, align); }
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { FreeAligned(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { FreeAligned(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { FreeAligned(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { FreeAligned(p); }
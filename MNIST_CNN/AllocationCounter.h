@@ -0,0 +1,8 @@
+#pragma once
+
+// Number of global operator new calls since the start of the process, counted by the
+// replacement operators in AllocationCounter.cpp. Training reports the difference over a
+// run to show that steady-state steps do not allocate.
+long long AllocationCount();
+// The same, counting only the calling thread's allocations
+long long ThreadAllocationCount();
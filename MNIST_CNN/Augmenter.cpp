@@ -0,0 +1,120 @@
+#include "Augmenter.h"
+#include "Simd.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace {
+    // Black border around the source: points up to a pixel outside the image still blend
+    // with it, anything further out clamps onto the border and reads black
+    const int PADDING = 2;
+    const Scalar PI = Scalar(3.14159265358979323846);
+}
+
+Augmenter::Augmenter(const Options& options, int height, int width, unsigned seed) :
+    options(options),
+    height(height),
+    width(width),
+    rng(seed),
+    stride(width + 2 * PADDING),
+    xs(width),
+    ys(width)
+{
+    assert(options.max_scale >= 0 && options.max_scale < 1 && options.elastic_sigma > 0);
+    padded.assign(size_t(height + 2 * PADDING) * stride, 0);
+
+    if (options.elastic_alpha > 0) {
+        const int radius = int(std::ceil(3 * options.elastic_sigma));
+        kernel.resize(2 * radius + 1);
+        Scalar sum = 0;
+        for (int t = -radius; t <= radius; ++t) {
+            kernel[t + radius] = std::exp(-t * t / (2 * options.elastic_sigma * options.elastic_sigma));
+            sum += kernel[t + radius];
+        }
+        for (Scalar& k : kernel) {
+            k /= sum;
+        }
+        dx.resize(height * width);
+        dy.resize(height * width);
+        rows.resize(height * width);
+        line.resize(width + 2 * radius);
+    }
+}
+
+void Augmenter::apply(const uint8_t* image, Scalar* out)
+{
+    for (int i = 0; i < height; ++i) {
+        Scalar* row = padded.data() + (i + PADDING) * stride + PADDING;
+        for (int j = 0; j < width; ++j) {
+            row[j] = image[i * width + j] / Scalar(255);
+        }
+    }
+
+    std::uniform_real_distribution<Scalar> unit(-1, 1);
+    const Scalar tx = options.max_shift * unit(rng);
+    const Scalar ty = options.max_shift * unit(rng);
+    const Scalar angle = options.max_rotation * PI / 180 * unit(rng);
+    const Scalar scale = 1 + options.max_scale * unit(rng);
+    if (options.elastic_alpha > 0) {
+        for (int i = 0; i < height * width; ++i) {
+            dx[i] = unit(rng);
+            dy[i] = unit(rng);
+        }
+        smooth(dx.data());
+        smooth(dy.data());
+    }
+
+    // Output pixel d comes from source point R(-angle) (d - center - shift) / scale + center
+    const Scalar a = std::cos(angle) / scale;
+    const Scalar b = std::sin(angle) / scale;
+    const Scalar cx = (width - 1) / Scalar(2);
+    const Scalar cy = (height - 1) / Scalar(2);
+    const Scalar maxX = Scalar(width + 2 * PADDING - 2);
+    const Scalar maxY = Scalar(height + 2 * PADDING - 2);
+    for (int i = 0; i < height; ++i) {
+        const Scalar v = i - cy - ty;
+        for (int j = 0; j < width; ++j) {
+            const Scalar u = j - cx - tx;
+            xs[j] = a * u + b * v + cx + PADDING;
+            ys[j] = -b * u + a * v + cy + PADDING;
+        }
+        if (options.elastic_alpha > 0) {
+            Simd().axpy(width, options.elastic_alpha, dx.data() + i * width, xs.data());
+            Simd().axpy(width, options.elastic_alpha, dy.data() + i * width, ys.data());
+        }
+        Simd().bilinear(width, padded.data(), stride, maxX, maxY, xs.data(), ys.data(), out + i * width);
+    }
+
+    if (options.noise > 0) {
+        std::normal_distribution<Scalar> noise(0, options.noise);
+        for (int i = 0; i < height * width; ++i) {
+            out[i] = std::min<Scalar>(std::max<Scalar>(out[i] + noise(rng), 0), 1);
+        }
+    }
+}
+
+void Augmenter::smooth(Scalar* field)
+{
+    const int radius = int(kernel.size()) / 2;
+    // along the rows, the edges repeated past the ends
+    for (int i = 0; i < height; ++i) {
+        const Scalar* in = field + i * width;
+        for (int j = 0; j < width + 2 * radius; ++j) {
+            line[j] = in[std::min(std::max(j - radius, 0), width - 1)];
+        }
+        Scalar* row = rows.data() + i * width;
+        std::fill(row, row + width, Scalar(0));
+        for (int t = 0; t < int(kernel.size()); ++t) {
+            Simd().axpy(width, kernel[t], line.data() + t, row);
+        }
+    }
+    // along the columns, a whole row at a time
+    for (int i = 0; i < height; ++i) {
+        Scalar* row = field + i * width;
+        std::fill(row, row + width, Scalar(0));
+        for (int t = 0; t < int(kernel.size()); ++t) {
+            const int source = std::min(std::max(i + t - radius, 0), height - 1);
+            Simd().axpy(width, kernel[t], rows.data() + source * width, row);
+        }
+    }
+}
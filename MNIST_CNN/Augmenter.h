@@ -0,0 +1,57 @@
+#pragma once
+#include "Scalar.h"
+#include <cstdint>
+#include <random>
+#include <vector>
+
+// Distorts training images on the fly, so every epoch sees new variants of the stored
+// samples. Each image gets a random affine transform (shift, rotation, scale), optionally
+// an elastic distortion (Simard et al. 2003: a random displacement field smoothed by a
+// Gaussian) and optionally Gaussian pixel noise. The output pixel grid is mapped back
+// into the source image and resampled with the bilinear SIMD kernel; the source counts as
+// black outside its borders.
+//
+// Not thread-safe: the input pipeline gives every producer thread its own Augmenter.
+class Augmenter
+{
+public:
+    struct Options {
+        // uniform in [-max_shift, max_shift] pixels per axis
+        Scalar max_shift = 2;
+        // uniform in [-max_rotation, max_rotation] degrees
+        Scalar max_rotation = 12;
+        // uniform in [1 - max_scale, 1 + max_scale]
+        Scalar max_scale = Scalar(0.1);
+        // scale of the smoothed displacement field in pixels, 0 turns the elastic distortion
+        // off; Simard et al. use 34 with a sigma of 4
+        Scalar elastic_alpha = 0;
+        // smoothing of the displacement field, in pixels
+        Scalar elastic_sigma = 4;
+        // standard deviation of the noise added to the [0, 1] pixels, clamped back into range
+        Scalar noise = 0;
+    };
+public:
+    Augmenter(const Options& options, int height, int width, unsigned seed);
+
+    // out gets height * width scalars in [0, 1]
+    void apply(const uint8_t* image, Scalar* out);
+private:
+    // Smooths a random field in place with the separable Gaussian
+    void smooth(Scalar* field);
+private:
+    Options options;
+    int height;
+    int width;
+    std::mt19937 rng;
+    // the source with a black border of PADDING pixels, for the bilinear kernel
+    std::vector<Scalar> padded;
+    int stride;
+    std::vector<Scalar> xs;
+    std::vector<Scalar> ys;
+    std::vector<Scalar> kernel;
+    // displacement fields and the scratch rows of smooth()
+    std::vector<Scalar> dx;
+    std::vector<Scalar> dy;
+    std::vector<Scalar> rows;
+    std::vector<Scalar> line;
+};
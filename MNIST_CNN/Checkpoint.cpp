@@ -0,0 +1,381 @@
+#include "Checkpoint.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    const char MAGIC[8] = { 'M', 'N', 'I', 'S', 'T', 'C', 'N', 'N' };
+    // reads back as 0x04030201 on a machine of the other byte order
+    const uint32_t BYTE_ORDER_MARK = 0x01020304;
+    const size_t PARAMS_ALIGNMENT = 64;
+    const int NAME_SIZE = 16;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t byteOrder;
+        uint32_t scalarSize;
+        uint32_t layers2d;
+        uint32_t layers;
+        uint32_t reserved;
+        // from the start of the file
+        uint64_t paramsOffset;
+        uint64_t paramCount;
+        // FNV-1a of the bytes from the end of the header to the end of the parameters
+        uint64_t checksum;
+    };
+
+    struct Layer2dRecord {
+        char name[NAME_SIZE];
+        int32_t height;
+        int32_t width;
+        int32_t depth;
+        int32_t kernel_dim;
+        int32_t kernel_stride;
+        int32_t kernel_num;
+        int32_t padding;
+        int32_t activation;
+    };
+
+    struct LayerRecord {
+        char name[NAME_SIZE];
+        int32_t input_size;
+        int32_t output_size;
+        int32_t activation;
+    };
+
+    // followed by rngSize bytes of generator state and orderSize int32 sample indices
+    struct ProgressRecord {
+        int64_t epoch;
+        int64_t sample;
+        uint32_t rngSize;
+        uint32_t orderSize;
+    };
+
+    // the records are copied to and from the file as they are laid out in memory
+    static_assert(sizeof(Header) == 56, "checkpoint header must not be padded");
+    static_assert(sizeof(ProgressRecord) == 24, "checkpoint records must not be padded");
+    static_assert(sizeof(Layer2dRecord) == NAME_SIZE + 8 * 4, "checkpoint records must not be padded");
+    static_assert(sizeof(LayerRecord) == NAME_SIZE + 3 * 4, "checkpoint records must not be padded");
+    static_assert(sizeof(int) == sizeof(int32_t), "sample indices are stored as int32");
+
+    uint64_t Fnv1a(const uint8_t* bytes, size_t count)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < count; ++i) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    void SetName(char* name, const std::string& layer_name)
+    {
+        if (layer_name.size() >= NAME_SIZE) {
+            throw std::runtime_error("layer name " + layer_name + " does not fit a checkpoint record");
+        }
+        std::memset(name, 0, NAME_SIZE);
+        std::memcpy(name, layer_name.data(), layer_name.size());
+    }
+
+    std::string GetName(const char* name)
+    {
+        return std::string(name, std::find(name, name + NAME_SIZE, '\0'));
+    }
+
+    EActivation GetActivation(int32_t activation, const std::string& path)
+    {
+        if (activation != int32_t(EActivation::ReLU) && activation != int32_t(EActivation::SIGMOID)) {
+            throw std::runtime_error(path + " has an unknown activation function");
+        }
+        return EActivation(activation);
+    }
+
+    void Append(std::vector<uint8_t>& bytes, const void* data, size_t size)
+    {
+        const uint8_t* begin = static_cast<const uint8_t*>(data);
+        bytes.insert(bytes.end(), begin, begin + size);
+    }
+
+    // Bytes on disk before path names them, then the rename; on POSIX the directory entry
+    // is synced as well so the rename itself survives a crash
+    void WriteDurably(const std::string& path, const std::vector<uint8_t>& bytes)
+    {
+        const std::string temporary = path + ".tmp";
+#ifdef _WIN32
+        HANDLE file = CreateFileA(temporary.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error("cannot write " + temporary);
+        }
+        DWORD written = 0;
+        const bool ok = WriteFile(file, bytes.data(), DWORD(bytes.size()), &written, nullptr)
+            && written == bytes.size() && FlushFileBuffers(file);
+        CloseHandle(file);
+        if (!ok) {
+            throw std::runtime_error("cannot write " + temporary);
+        }
+        if (!MoveFileExA(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+            throw std::runtime_error("cannot replace " + path);
+        }
+#else
+        const int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("cannot write " + temporary);
+        }
+        size_t done = 0;
+        while (done < bytes.size()) {
+            const ssize_t written = write(fd, bytes.data() + done, bytes.size() - done);
+            if (written <= 0) {
+                break;
+            }
+            done += written;
+        }
+        const bool ok = done == bytes.size() && fsync(fd) == 0;
+        close(fd);
+        if (!ok) {
+            throw std::runtime_error("cannot write " + temporary);
+        }
+        if (rename(temporary.c_str(), path.c_str()) != 0) {
+            throw std::runtime_error("cannot replace " + path);
+        }
+        const size_t slash = path.find_last_of('/');
+        const std::string directory = (slash == std::string::npos) ? "." : path.substr(0, slash + 1);
+        const int dirFd = open(directory.c_str(), O_RDONLY);
+        if (dirFd >= 0) {
+            fsync(dirFd);
+            close(dirFd);
+        }
+#endif
+    }
+}
+
+void Checkpoint::save(const std::string& path, const std::vector<Layer2d::Topology>& topology2d,
+    const std::vector<Layer::Topology>& topology, const Scalar* params, int paramCount,
+    const TrainProgress& progress)
+{
+    std::vector<uint8_t> bytes(sizeof(Header));
+    for (const auto& t : topology2d) {
+        Layer2dRecord record;
+        SetName(record.name, t.layer_name);
+        record.height = t.input_size.height;
+        record.width = t.input_size.width;
+        record.depth = t.input_size.depth;
+        record.kernel_dim = t.kernel_dim;
+        record.kernel_stride = t.kernel_stride;
+        record.kernel_num = t.kernel_num;
+        record.padding = t.padding;
+        record.activation = int32_t(t.activation_func);
+        Append(bytes, &record, sizeof(record));
+    }
+    for (const auto& t : topology) {
+        LayerRecord record;
+        SetName(record.name, t.layer_name);
+        record.input_size = t.input_size;
+        record.output_size = t.output_size;
+        record.activation = int32_t(t.activation_func);
+        Append(bytes, &record, sizeof(record));
+    }
+    ProgressRecord record;
+    record.epoch = progress.epoch;
+    record.sample = progress.sample;
+    record.rngSize = progress.rng.size();
+    record.orderSize = progress.order.size();
+    Append(bytes, &record, sizeof(record));
+    Append(bytes, progress.rng.data(), progress.rng.size());
+    Append(bytes, progress.order.data(), progress.order.size() * sizeof(int32_t));
+
+    bytes.resize((bytes.size() + PARAMS_ALIGNMENT - 1) / PARAMS_ALIGNMENT * PARAMS_ALIGNMENT, 0);
+    Header header = {};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.scalarSize = sizeof(Scalar);
+    header.layers2d = topology2d.size();
+    header.layers = topology.size();
+    header.paramsOffset = bytes.size();
+    header.paramCount = paramCount;
+
+    const uint8_t* paramBytes = reinterpret_cast<const uint8_t*>(params);
+    bytes.insert(bytes.end(), paramBytes, paramBytes + size_t(paramCount) * sizeof(Scalar));
+    header.checksum = Fnv1a(bytes.data() + sizeof(Header), bytes.size() - sizeof(Header));
+    std::memcpy(bytes.data(), &header, sizeof(Header));
+
+    WriteDurably(path, bytes);
+}
+
+Checkpoint::Checkpoint(const std::string& path) :
+    file(path, true)
+{
+    Header header;
+    if (file.size() < sizeof(Header)) {
+        throw std::runtime_error(path + " is not a checkpoint");
+    }
+    std::memcpy(&header, file.data(), sizeof(Header));
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+        throw std::runtime_error(path + " is not a checkpoint");
+    }
+    if (header.version < 1 || header.version > VERSION) {
+        throw std::runtime_error(path + " is checkpoint version " + std::to_string(header.version)
+            + ", this build reads version " + std::to_string(VERSION));
+    }
+    if (header.byteOrder != BYTE_ORDER_MARK || header.scalarSize != sizeof(Scalar)) {
+        throw std::runtime_error(path + " was written with another byte order or scalar type");
+    }
+
+    const uint64_t layersEnd = sizeof(Header) + uint64_t(header.layers2d) * sizeof(Layer2dRecord)
+        + uint64_t(header.layers) * sizeof(LayerRecord);
+    const uint64_t paramsEnd = header.paramsOffset + header.paramCount * sizeof(Scalar);
+    if (header.paramsOffset % PARAMS_ALIGNMENT != 0 || header.paramsOffset < layersEnd
+        || header.paramCount > uint64_t(INT32_MAX) || paramsEnd > file.size()) {
+        throw std::runtime_error(path + " is truncated or has a corrupt header");
+    }
+    ProgressRecord record = {};
+    if (header.version >= 2) {
+        if (layersEnd + sizeof(ProgressRecord) > header.paramsOffset) {
+            throw std::runtime_error(path + " is truncated or has a corrupt header");
+        }
+        std::memcpy(&record, file.data() + layersEnd, sizeof(record));
+        if (layersEnd + sizeof(ProgressRecord) + record.rngSize + uint64_t(record.orderSize) * sizeof(int32_t) > header.paramsOffset) {
+            throw std::runtime_error(path + " is truncated or has a corrupt header");
+        }
+    }
+    if (Fnv1a(file.data() + sizeof(Header), paramsEnd - sizeof(Header)) != header.checksum) {
+        throw std::runtime_error(path + " fails its checksum");
+    }
+
+    const uint8_t* cursor = file.data() + sizeof(Header);
+    for (uint32_t i = 0; i < header.layers2d; ++i, cursor += sizeof(Layer2dRecord)) {
+        Layer2dRecord record;
+        std::memcpy(&record, cursor, sizeof(record));
+        Layer2d::Topology t;
+        t.layer_name = GetName(record.name);
+        t.input_size = { record.height, record.width, record.depth };
+        t.kernel_dim = record.kernel_dim;
+        t.kernel_stride = record.kernel_stride;
+        t.kernel_num = record.kernel_num;
+        t.padding = record.padding;
+        t.activation_func = GetActivation(record.activation, path);
+        topology2d.push_back(t);
+    }
+    for (uint32_t i = 0; i < header.layers; ++i, cursor += sizeof(LayerRecord)) {
+        LayerRecord record;
+        std::memcpy(&record, cursor, sizeof(record));
+        Layer::Topology t;
+        t.layer_name = GetName(record.name);
+        t.input_size = record.input_size;
+        t.output_size = record.output_size;
+        t.activation_func = GetActivation(record.activation, path);
+        topology.push_back(t);
+    }
+
+    if (header.version >= 2) {
+        cursor += sizeof(ProgressRecord);
+        progress.epoch = int(record.epoch);
+        progress.sample = int(record.sample);
+        progress.rng.assign(reinterpret_cast<const char*>(cursor), record.rngSize);
+        cursor += record.rngSize;
+        progress.order.resize(record.orderSize);
+        std::memcpy(progress.order.data(), cursor, record.orderSize * sizeof(int32_t));
+    }
+
+    params = reinterpret_cast<Scalar*>(file.data() + header.paramsOffset);
+    paramCount = int(header.paramCount);
+}
+
+bool CheckpointSelfTest(std::ostream& log)
+{
+    const std::string path = (std::filesystem::temp_directory_path() / "mnist_cnn_selftest.ckpt").string();
+    const std::vector<Layer2d::Topology> topology2d = {
+        { "Conv2d", {28,28,1}, 5, 1, 16, 0, EActivation::ReLU },
+        { "Maxpool", {24,24,16}, 2, 2, 16, 0, EActivation::ReLU },
+    };
+    const std::vector<Layer::Topology> topology = {
+        { "Dense", 12*12*16, 30, EActivation::SIGMOID },
+        { "Softmax", 30, 10, EActivation::ReLU },
+    };
+
+    // odd count, so the parameters do not end on a cache line
+    std::mt19937 gen(17);
+    std::uniform_real_distribution<Scalar> dist(-1, 1);
+    AlignedMat params(1001);
+    for (Scalar& x : params) {
+        x = dist(gen);
+    }
+    TrainProgress progress;
+    progress.epoch = 3;
+    progress.sample = 4321;
+    std::ostringstream rng;
+    rng << gen;
+    progress.rng = rng.str();
+    progress.order.resize(5000);
+    for (int i = 0; i < int(progress.order.size()); ++i) {
+        progress.order[i] = (i * 7919) % int(progress.order.size());
+    }
+    Checkpoint::save(path, topology2d, topology, params.data(), int(params.size()), progress);
+
+    bool roundTrip = false;
+    {
+        Checkpoint loaded(path);
+        const TrainProgress& p = loaded.getProgress();
+        roundTrip = loaded.getParamCount() == int(params.size())
+            && std::memcmp(loaded.getParams(), params.data(), params.size() * sizeof(Scalar)) == 0
+            && loaded.getTopology2d().size() == topology2d.size() && loaded.getTopology().size() == topology.size()
+            && p.epoch == progress.epoch && p.sample == progress.sample && p.rng == progress.rng && p.order == progress.order;
+        for (size_t i = 0; roundTrip && i < topology2d.size(); ++i) {
+            const Layer2d::Topology& a = topology2d[i];
+            const Layer2d::Topology& b = loaded.getTopology2d()[i];
+            roundTrip = a.layer_name == b.layer_name && a.input_size.height == b.input_size.height
+                && a.input_size.width == b.input_size.width && a.input_size.depth == b.input_size.depth
+                && a.kernel_dim == b.kernel_dim && a.kernel_stride == b.kernel_stride && a.kernel_num == b.kernel_num
+                && a.padding == b.padding && a.activation_func == b.activation_func;
+        }
+        for (size_t i = 0; roundTrip && i < topology.size(); ++i) {
+            const Layer::Topology& a = topology[i];
+            const Layer::Topology& b = loaded.getTopology()[i];
+            roundTrip = a.layer_name == b.layer_name && a.input_size == b.input_size && a.output_size == b.output_size
+                && a.activation_func == b.activation_func;
+        }
+    }
+    log << "checkpoint round trip: " << (roundTrip ? "ok" : "MISMATCH") << std::endl;
+
+    // one flipped bit in the progress section and one in the last parameter
+    const uintmax_t size = std::filesystem::file_size(path);
+    const uintmax_t offsets[] = { sizeof(Header) + topology2d.size() * sizeof(Layer2dRecord) + topology.size() * sizeof(LayerRecord) + 8, size - 1 };
+    bool corruptionCaught = true;
+    for (const uintmax_t offset : offsets) {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekg(offset);
+        const char byte = char(file.get());
+        file.seekp(offset);
+        file.put(char(byte ^ 0x10));
+        file.close();
+        try {
+            Checkpoint corrupt(path);
+            corruptionCaught = false;
+        }
+        catch (const std::runtime_error&) {
+        }
+        file.open(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(offset);
+        file.put(byte);
+    }
+    log << "checkpoint corruption: " << (corruptionCaught ? "rejected" : "NOT DETECTED") << std::endl;
+
+    std::remove(path.c_str());
+    return roundTrip && corruptionCaught;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include "Layer.h"
+#include "Layer2d.h"
+#include "MappedFile.h"
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// Where a training run stands, stored with the parameters so a run can resume from it
+struct TrainProgress {
+    int epoch = 0;
+    // samples of the epoch already trained on
+    int sample = 0;
+    // state of the generator that shuffles the epochs, as written by operator<<
+    std::string rng;
+    // dataset indices of the epoch's samples in training order
+    std::vector<int> order;
+};
+
+// Binary checkpoint: a fixed header, one fixed-size record per layer of the topology, the
+// training progress and the Net's flat parameter buffer verbatim, starting on a 64-byte
+// boundary. Integers and scalars are in the writer's native byte order, the header records
+// it along with the scalar size and an FNV-1a checksum of everything after the header.
+// Version 1 files have no progress section.
+//
+// Loading maps the file copy-on-write and hands out the parameters in place, so a process
+// can predict without reading or converting them, and training on top of them only copies
+// the pages it touches.
+class Checkpoint
+{
+public:
+    static const int VERSION = 2;
+
+    // Writes and fsyncs a temporary file next to path, then renames it over path: a crash
+    // leaves either the previous or the new checkpoint, and a process that mapped the
+    // previous one keeps reading consistent data
+    static void save(const std::string& path, const std::vector<Layer2d::Topology>& topology2d,
+        const std::vector<Layer::Topology>& topology, const Scalar* params, int paramCount,
+        const TrainProgress& progress = TrainProgress());
+
+    // Maps and validates the file, throws std::runtime_error when it is not a checkpoint
+    // this build can use
+    explicit Checkpoint(const std::string& path);
+
+    const std::vector<Layer2d::Topology>& getTopology2d() const { return topology2d; }
+    const std::vector<Layer::Topology>& getTopology() const { return topology; }
+    const TrainProgress& getProgress() const { return progress; }
+    // 64-byte aligned, valid while the Checkpoint lives
+    Scalar* getParams() { return params; }
+    int getParamCount() const { return paramCount; }
+private:
+    MappedFile file;
+    std::vector<Layer2d::Topology> topology2d;
+    std::vector<Layer::Topology> topology;
+    TrainProgress progress;
+    Scalar* params = nullptr;
+    int paramCount = 0;
+};
+
+// Saves and loads a checkpoint in the temporary directory, expects the same topology,
+// parameters and progress back and a flipped bit to be rejected
+bool CheckpointSelfTest(std::ostream& log);
@@ -0,0 +1,142 @@
+#include "CheckpointWriter.h"
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+CheckpointWriter::CheckpointWriter(const std::string& path, const std::vector<Layer2d::Topology>& topology2d,
+    const std::vector<Layer::Topology>& topology) :
+    path(path),
+    topology2d(topology2d),
+    topology(topology),
+    thread(&CheckpointWriter::writerLoop, this)
+{
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    wake.notify_all();
+    thread.join();
+}
+
+void CheckpointWriter::snapshot(const Scalar* params, int paramCount, const TrainProgress& progress)
+{
+    int target;
+    {
+        // the buffer the thread is not writing; a snapshot still waiting in it is taken back
+        std::lock_guard<std::mutex> lock(mutex);
+        target = (writing == 0) ? 1 : 0;
+        if (pending == target) {
+            pending = -1;
+        }
+    }
+
+    // after the first snapshot the buffers have their size, so these copies do not allocate
+    Buffer& buffer = buffers[target];
+    buffer.params.assign(params, params + paramCount);
+    buffer.progress.epoch = progress.epoch;
+    buffer.progress.sample = progress.sample;
+    buffer.progress.rng.assign(progress.rng);
+    buffer.progress.order.assign(progress.order.begin(), progress.order.end());
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending = target;
+    }
+    wake.notify_all();
+}
+
+void CheckpointWriter::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return pending == -1 && writing == -1; });
+}
+
+void CheckpointWriter::writerLoop()
+{
+    for (;;) {
+        int target;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stop || pending != -1; });
+            if (pending == -1) {
+                return;
+            }
+            target = pending;
+            pending = -1;
+            writing = target;
+        }
+
+        const Buffer& buffer = buffers[target];
+        try {
+            Checkpoint::save(path, topology2d, topology, buffer.params.data(), buffer.params.size(), buffer.progress);
+        }
+        catch (const std::exception& e) {
+            // training goes on, the previous checkpoint stays in place
+            std::cerr << e.what() << std::endl;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            writing = -1;
+        }
+        done.notify_all();
+    }
+}
+
+bool CheckpointWriterSelfTest(std::ostream& log)
+{
+    const std::string path = (std::filesystem::temp_directory_path() / "mnist_cnn_writer_selftest.ckpt").string();
+    const std::vector<Layer::Topology> topology = { { "Softmax", 99, 10, EActivation::ReLU } };
+    const int paramCount = 99 * 10 + 10;
+
+    AlignedMat params(paramCount);
+    TrainProgress progress;
+    progress.rng = "generator state";
+    progress.order = { 4, 2, 0, 3, 1 };
+    auto matches = [&](const AlignedMat& expected, const TrainProgress& p) {
+        Checkpoint loaded(path);
+        const TrainProgress& q = loaded.getProgress();
+        return loaded.getParamCount() == paramCount
+            && std::memcmp(loaded.getParams(), expected.data(), paramCount * sizeof(Scalar)) == 0
+            && q.epoch == p.epoch && q.sample == p.sample && q.rng == p.rng && q.order == p.order;
+    };
+
+    bool passed = true;
+    {
+        CheckpointWriter writer(path, {}, topology);
+        for (int round = 0; round < 3; ++round) {
+            for (int i = 0; i < paramCount; ++i) {
+                params[i] = Scalar(round * paramCount + i);
+            }
+            progress.epoch = round;
+            progress.sample = round * 100;
+            const AlignedMat expected = params;
+            const TrainProgress expectedProgress = progress;
+            // training carries on with the buffers as soon as snapshot() returns
+            writer.snapshot(params.data(), paramCount, progress);
+            std::fill(params.begin(), params.end(), Scalar(-1));
+            progress.order.push_back(round);
+            writer.flush();
+            passed &= matches(expected, expectedProgress);
+        }
+
+        // a snapshot taken while the previous one waits replaces it, the last one has to land
+        for (int i = 0; i < paramCount; ++i) {
+            params[i] = Scalar(i % 7);
+        }
+        writer.snapshot(params.data(), paramCount, progress);
+        progress.sample = 12345;
+        writer.snapshot(params.data(), paramCount, progress);
+        writer.flush();
+        passed &= matches(params, progress);
+    }
+    log << "checkpoint writer: " << (passed ? "ok" : "MISMATCH") << std::endl;
+
+    std::remove(path.c_str());
+    return passed;
+}
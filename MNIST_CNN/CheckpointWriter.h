@@ -0,0 +1,50 @@
+#pragma once
+#include "Checkpoint.h"
+#include <condition_variable>
+#include <iosfwd>
+#include <mutex>
+#include <thread>
+
+// Writes checkpoints on a background thread. snapshot() only copies the parameters and the
+// progress into one of two buffers and returns; the thread serialises, fsyncs and renames
+// the other one into place meanwhile. A snapshot taken while the previous one still waits
+// for the thread replaces it, so a slow disk drops intermediate checkpoints instead of
+// stalling training.
+class CheckpointWriter
+{
+public:
+    CheckpointWriter(const std::string& path, const std::vector<Layer2d::Topology>& topology2d,
+        const std::vector<Layer::Topology>& topology);
+    // Finishes the last snapshot before returning
+    ~CheckpointWriter();
+    CheckpointWriter(const CheckpointWriter&) = delete;
+    void operator=(const CheckpointWriter&) = delete;
+
+    void snapshot(const Scalar* params, int paramCount, const TrainProgress& progress);
+    // Blocks until every snapshot taken so far is on disk
+    void flush();
+private:
+    struct Buffer {
+        AlignedMat params;
+        TrainProgress progress;
+    };
+
+    void writerLoop();
+private:
+    std::string path;
+    std::vector<Layer2d::Topology> topology2d;
+    std::vector<Layer::Topology> topology;
+    Buffer buffers[2];
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    // buffer being written by the thread and the one waiting for it, -1 for none
+    int writing = -1;
+    int pending = -1;
+    bool stop = false;
+    std::thread thread;
+};
+
+// Writes snapshots in the temporary directory while their buffers are overwritten, expects
+// the parameters and progress of the last snapshot back once flushed
+bool CheckpointWriterSelfTest(std::ostream& log);
@@ -0,0 +1,227 @@
+#include "ConvTuner.h"
+#include "Simd.h"
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <random>
+#include <sstream>
+
+namespace {
+    // samples per timed pass, enough to amortize the per-batch setup
+    const int TUNING_BATCH = 8;
+    const EConvAlgorithm ALGORITHMS[] = { EConvAlgorithm::Direct, EConvAlgorithm::Im2col, EConvAlgorithm::Winograd };
+
+    // Forward algorithms measured by this process, by key. A Net is tuned for inference on
+    // construction and for training by its first train(); the second tuning takes the
+    // forward pass from here instead of timing it again. Not saved: the file only holds
+    // complete decisions.
+    std::mutex measuredMutex;
+    std::map<std::string, EConvAlgorithm> measuredForward;
+
+    bool Parse(const std::string& name, EConvAlgorithm& algorithm)
+    {
+        for (EConvAlgorithm candidate : ALGORITHMS) {
+            if (name == ToString(candidate)) {
+                algorithm = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Seconds per call, the best of a few runs that each repeat the call for a few milliseconds
+    template <typename Func>
+    double TimePerCall(const Func& func)
+    {
+        typedef std::chrono::steady_clock Clock;
+        func();
+        double best = std::numeric_limits<double>::max();
+        for (int run = 0; run < 3; ++run) {
+            const Clock::time_point start = Clock::now();
+            int calls = 0;
+            std::chrono::duration<double> elapsed;
+            do {
+                func();
+                ++calls;
+                elapsed = Clock::now() - start;
+            } while (elapsed.count() < 0.005);
+            best = std::min(best, elapsed.count() / calls);
+        }
+        return best;
+    }
+}
+
+ConvTuner::ConvTuner()
+{
+    const char* file = std::getenv("MNIST_CNN_TUNING");
+    path = file ? file : "conv_tuning.txt";
+    machine = CpuModel() + "|" + Simd().name + "|" + (sizeof(Scalar) == sizeof(float) ? "float" : "double");
+
+    // key <tab> forward <tab> backward, one shape per line
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string key, forward, backward;
+        Choice choice;
+        if (std::getline(fields, key, '\t') && std::getline(fields, forward, '\t') && std::getline(fields, backward)
+            && Parse(forward, choice.forward) && Parse(backward, choice.backward)) {
+            choices[key] = choice;
+        }
+    }
+}
+
+std::string ConvTuner::key(const Conv2d& layer) const
+{
+    const Tensor::Size in = layer.getInputSize();
+    std::ostringstream key;
+    key << machine << "|";
+    // the fused pooling changes what the forward and backward passes do around the convolution
+    if (const ConvPool2d* fused = dynamic_cast<const ConvPool2d*>(&layer)) {
+        key << "ConvPool2d " << fused->getPoolDim() << "x" << fused->getPoolDim();
+    }
+    else {
+        key << "Conv2d";
+    }
+    key << "|" << in.height << "x" << in.width << "x" << in.depth
+        << "|" << layer.getKernelNum() << "x" << layer.getKernelDim() << "x" << layer.getKernelDim()
+        << "|stride " << layer.getKernelStride() << "|padding " << layer.getKernelPadding();
+    return key.str();
+}
+
+ConvTuner::Choice ConvTuner::tune(const Conv2d& layer, bool backward)
+{
+    const char* forced = std::getenv("MNIST_CNN_CONV");
+    EConvAlgorithm algorithm;
+    if (forced && Parse(forced, algorithm)) {
+        Choice choice = { EConvAlgorithm::Im2col, backward ? EConvAlgorithm::Im2col : EConvAlgorithm::Direct };
+        if (layer.supportsForward(algorithm)) {
+            choice.forward = algorithm;
+        }
+        if (backward && layer.supportsBackward(algorithm)) {
+            choice.backward = algorithm;
+        }
+        return choice;
+    }
+
+    const std::string shape = key(layer);
+    auto found = choices.find(shape);
+    if (found != choices.end()) {
+        return backward ? found->second : Choice{ found->second.forward, EConvAlgorithm::Direct };
+    }
+    EConvAlgorithm forward;
+    bool measured;
+    {
+        std::lock_guard<std::mutex> lock(measuredMutex);
+        auto remembered = measuredForward.find(shape);
+        measured = remembered != measuredForward.end();
+        forward = measured ? remembered->second : EConvAlgorithm::Im2col;
+    }
+    if (measured && !backward) {
+        return Choice{ forward, EConvAlgorithm::Direct };
+    }
+    Choice choice = measure(layer, !measured, backward);
+    if (measured) {
+        choice.forward = forward;
+    }
+    else {
+        std::lock_guard<std::mutex> lock(measuredMutex);
+        measuredForward[shape] = choice.forward;
+    }
+    if (backward) {
+        choices[shape] = choice;
+        changed = true;
+    }
+    return choice;
+}
+
+ConvTuner::Choice ConvTuner::measure(const Conv2d& layer, bool forward, bool backward) const
+{
+    // a private copy with its own parameters, so the measurements leave the network alone
+    std::unique_ptr<Layer2d> copy = layer.clone();
+    Conv2d& conv = static_cast<Conv2d&>(*copy);
+    std::mt19937 gen(1);
+    std::uniform_real_distribution<Scalar> dist(-1, 1);
+
+    Mat params(conv.getParamCount());
+    Mat grads(conv.getParamCount());
+    for (Scalar& p : params) {
+        p = dist(gen) / 10;
+    }
+    conv.bindParams(params.data(), grads.data());
+    Workspace workspace;
+    workspace.reserve(conv.getWorkspaceSize(TUNING_BATCH));
+    conv.bindWorkspace(&workspace);
+
+    Tensor::Size inSize = conv.getInputSize();
+    inSize.batch = TUNING_BATCH;
+    Tensor input(inSize);
+    for (int i = 0; i < input.getRawSize(); ++i) {
+        input[i] = dist(gen);
+    }
+    Tensor::Size outSize = conv.getOutputSize();
+    outSize.batch = TUNING_BATCH;
+    Tensor dL_dA(outSize);
+    for (int i = 0; i < dL_dA.getRawSize(); ++i) {
+        dL_dA[i] = dist(gen);
+    }
+
+    // Each pass is timed with the other one on Direct, so neither the forward nor the
+    // backward Im2col is credited with the lowering the other one would share
+    Choice choice = { EConvAlgorithm::Im2col, backward ? EConvAlgorithm::Im2col : EConvAlgorithm::Direct };
+    double forwardTime = std::numeric_limits<double>::max();
+    double backwardTime = std::numeric_limits<double>::max();
+    for (EConvAlgorithm algorithm : ALGORITHMS) {
+        if (forward && conv.supportsForward(algorithm)) {
+            conv.setAlgorithms(algorithm, EConvAlgorithm::Direct);
+            const double time = TimePerCall([&] { conv.feedForward(input); });
+            if (time < forwardTime) {
+                forwardTime = time;
+                choice.forward = algorithm;
+            }
+        }
+        if (backward && conv.supportsBackward(algorithm)) {
+            conv.setAlgorithms(EConvAlgorithm::Direct, algorithm);
+            conv.feedForward(input);
+            const double time = TimePerCall([&] {
+                workspace.reset();
+                conv.backProp(dL_dA);
+            });
+            if (time < backwardTime) {
+                backwardTime = time;
+                choice.backward = algorithm;
+            }
+        }
+    }
+
+    // stdout may be the answer stream of a server
+    std::cerr << "conv " << inSize.height << "x" << inSize.width << "x" << inSize.depth
+        << " -> " << conv.getKernelNum() << "x" << conv.getKernelDim() << "x" << conv.getKernelDim() << ":";
+    if (forward) {
+        std::cerr << " forward " << ToString(choice.forward) << " (" << forwardTime * 1e6 / TUNING_BATCH << " us/image)";
+    }
+    if (forward && backward) {
+        std::cerr << ",";
+    }
+    if (backward) {
+        std::cerr << " backward " << ToString(choice.backward) << " (" << backwardTime * 1e6 / TUNING_BATCH << " us/image)";
+    }
+    std::cerr << std::endl;
+    return choice;
+}
+
+void ConvTuner::save() const
+{
+    if (!changed) {
+        return;
+    }
+    std::ofstream out(path);
+    for (const auto& entry : choices) {
+        out << entry.first << "\t" << ToString(entry.second.forward) << "\t" << ToString(entry.second.backward) << "\n";
+    }
+    if (!out) {
+        std::cerr << "could not write the convolution tuning file " << path << std::endl;
+    }
+}
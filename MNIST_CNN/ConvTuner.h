@@ -0,0 +1,36 @@
+#pragma once
+#include "Layer2d.h"
+#include <map>
+#include <string>
+
+// Picks the fastest forward and backward algorithm of a convolution by timing every
+// candidate on a copy of the layer, logging the measurements to stderr. Decisions are kept
+// in a small text file keyed by the layer kind and shape, the CPU model and the SIMD
+// variant, so later runs skip the measurements. MNIST_CNN_TUNING names the file
+// (conv_tuning.txt by default), MNIST_CNN_CONV=direct|im2col|winograd forces an algorithm
+// wherever the layer supports it.
+class ConvTuner
+{
+public:
+    struct Choice {
+        EConvAlgorithm forward;
+        EConvAlgorithm backward;
+    };
+public:
+    ConvTuner();
+    // Without backward only the forward pass is looked up or timed, and the backward
+    // algorithm is Direct, which needs no lowering buffer; such a measurement is not saved,
+    // but the process reuses it when the same shape is tuned for training later
+    Choice tune(const Conv2d& layer, bool backward = true);
+    // Writes the decisions back if any were measured
+    void save() const;
+private:
+    std::string key(const Conv2d& layer) const;
+    // Times the passes asked for; the forward choice is Im2col when it is not timed
+    Choice measure(const Conv2d& layer, bool forward, bool backward) const;
+private:
+    std::string path;
+    std::string machine;
+    std::map<std::string, Choice> choices;
+    bool changed = false;
+};
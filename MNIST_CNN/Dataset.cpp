@@ -0,0 +1,54 @@
+#include "Dataset.h"
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+
+Dataset::Dataset(int count, int height, int width) :
+    count(count),
+    img_height(height),
+    img_width(width),
+    ownedImages(size_t(count) * height * width),
+    ownedLabels(count)
+{
+    images = ownedImages.data();
+    labels = ownedLabels.data();
+}
+
+Dataset::Dataset(const uint8_t* images, const uint8_t* labels, int count, int height, int width) :
+    count(count),
+    img_height(height),
+    img_width(width),
+    images(images),
+    labels(labels)
+{
+}
+
+DatasetView::DatasetView(const Dataset& dataset) :
+    dataset(&dataset),
+    indices(dataset.size())
+{
+    std::iota(indices.begin(), indices.end(), 0);
+}
+
+DatasetView::DatasetView(const Dataset& dataset, std::vector<int> indices) :
+    dataset(&dataset),
+    indices(std::move(indices))
+{
+}
+
+DatasetView DatasetView::slice(int begin, int end) const
+{
+    assert(0 <= begin && begin <= end && end <= size());
+    return DatasetView(*dataset, std::vector<int>(indices.begin() + begin, indices.begin() + end));
+}
+
+std::pair<DatasetView, DatasetView> DatasetView::split(double fraction) const
+{
+    const int first = fraction * size();
+    return { slice(0, first), slice(first, size()) };
+}
+
+void DatasetView::shuffle(std::mt19937& rng)
+{
+    std::shuffle(indices.begin(), indices.end(), rng);
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <cstdint>
+#include <random>
+#include <utility>
+#include <vector>
+#include "AlignedAllocator.h"
+
+// Labeled images stored back to back in one contiguous uint8 buffer, one
+// height * width row per image, with the labels in a parallel uint8 array.
+// The buffer is either owned (64-byte aligned) or borrowed, e.g. from a mapped IDX file.
+class Dataset
+{
+public:
+    Dataset(int count, int height, int width);
+    Dataset(const uint8_t* images, const uint8_t* labels, int count, int height, int width);
+    Dataset(const Dataset&) = delete;
+    void operator=(const Dataset&) = delete;
+
+    int size() const { return count; }
+    int height() const { return img_height; }
+    int width() const { return img_width; }
+    int imageSize() const { return img_height * img_width; }
+    const uint8_t* image(int i) const { return images + size_t(i) * imageSize(); }
+    int label(int i) const { return labels[i]; }
+    // only for owned storage
+    uint8_t* image(int i) { return ownedImages.data() + size_t(i) * imageSize(); }
+    void setLabel(int i, int label) { ownedLabels[i] = label; }
+private:
+    int count;
+    int img_height;
+    int img_width;
+    std::vector<uint8_t, AlignedAllocator<uint8_t>> ownedImages;
+    std::vector<uint8_t> ownedLabels;
+    const uint8_t* images;
+    const uint8_t* labels;
+};
+
+// Ordered subset of a Dataset given by sample indices: splits and shuffles
+// rearrange the indices and never copy images
+class DatasetView
+{
+public:
+    DatasetView() {}
+    explicit DatasetView(const Dataset& dataset);
+    DatasetView(const Dataset& dataset, std::vector<int> indices);
+
+    int size() const { return indices.size(); }
+    const uint8_t* image(int i) const { return dataset->image(indices[i]); }
+    int label(int i) const { return dataset->label(indices[i]); }
+    int index(int i) const { return indices[i]; }
+    const std::vector<int>& getIndices() const { return indices; }
+    const Dataset& getDataset() const { return *dataset; }
+
+    DatasetView slice(int begin, int end) const;
+    // first `fraction` of the samples and the rest
+    std::pair<DatasetView, DatasetView> split(double fraction) const;
+    void shuffle(std::mt19937& rng);
+private:
+    const Dataset* dataset = nullptr;
+    std::vector<int> indices;
+};
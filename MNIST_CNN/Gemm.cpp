@@ -0,0 +1,124 @@
+#include "Gemm.h"
+#include "Simd.h"
+#include "AlignedAllocator.h"
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+namespace {
+    // Register block of the micro-kernel and cache blocks of the packed panels:
+    // an MC x KC panel of A stays in L2, a KC x NR sliver of B stays in L1.
+    const int MR = SimdKernels::MR;
+    const int NR = SimdKernels::NR;
+    const int MC = 96;
+    const int KC = 256;
+    const int NC = 2048;
+
+    void PackA(bool transA, const Scalar* A, int lda, int row0, int col0, int mc, int kc, Scalar* packed)
+    {
+        for (int ir = 0; ir < mc; ir += MR) {
+            const int m = std::min(MR, mc - ir);
+            for (int p = 0; p < kc; ++p) {
+                for (int i = 0; i < MR; ++i) {
+                    Scalar val = 0;
+                    if (i < m) {
+                        const int r = row0 + ir + i;
+                        const int c = col0 + p;
+                        val = transA ? A[c * lda + r] : A[r * lda + c];
+                    }
+                    *packed++ = val;
+                }
+            }
+        }
+    }
+
+    void PackB(bool transB, const Scalar* B, int ldb, int row0, int col0, int kc, int nc, Scalar* packed)
+    {
+        for (int jr = 0; jr < nc; jr += NR) {
+            const int n = std::min(NR, nc - jr);
+            for (int p = 0; p < kc; ++p) {
+                for (int j = 0; j < NR; ++j) {
+                    Scalar val = 0;
+                    if (j < n) {
+                        const int r = row0 + p;
+                        const int c = col0 + jr + j;
+                        val = transB ? B[c * ldb + r] : B[r * ldb + c];
+                    }
+                    *packed++ = val;
+                }
+            }
+        }
+    }
+
+    void StoreTile(const Scalar* acc, int m, int n, int row0, int col0,
+        Scalar alpha, Scalar beta, bool first, bool last, Scalar* C, int ldc, const GemmEpilogue& epilogue)
+    {
+        for (int i = 0; i < m; ++i) {
+            Scalar* c = C + (row0 + i) * ldc + col0;
+            const Scalar rowBias = epilogue.row_bias ? epilogue.row_bias[row0 + i] : 0;
+            for (int j = 0; j < n; ++j) {
+                Scalar val = alpha * acc[i * NR + j];
+                if (!first) {
+                    val += c[j];
+                }
+                else if (beta != 0) {
+                    val += beta * c[j];
+                }
+
+                if (last) {
+                    val += rowBias;
+                    if (epilogue.col_bias) {
+                        val += epilogue.col_bias[col0 + j];
+                    }
+                }
+                c[j] = val;
+            }
+            if (last && epilogue.activation) {
+                epilogue.activation(n, c);
+            }
+        }
+    }
+}
+
+void Gemm(bool transA, bool transB, int M, int N, int K,
+    Scalar alpha, const Scalar* A, int lda, const Scalar* B, int ldb,
+    Scalar beta, Scalar* C, int ldc, const GemmEpilogue& epilogue)
+{
+    assert(K > 0);
+    if (M <= 0 || N <= 0) {
+        return;
+    }
+
+    thread_local std::vector<Scalar, AlignedAllocator<Scalar>> packedA;
+    thread_local std::vector<Scalar, AlignedAllocator<Scalar>> packedB;
+    packedA.resize(MC * KC);
+    packedB.resize(KC * NC);
+
+    const SimdKernels& simd = Simd();
+    Scalar acc[MR * NR];
+    for (int jc = 0; jc < N; jc += NC) {
+        const int nc = std::min(NC, N - jc);
+        for (int pc = 0; pc < K; pc += KC) {
+            const int kc = std::min(KC, K - pc);
+            const bool first = pc == 0;
+            const bool last = pc + kc == K;
+            PackB(transB, B, ldb, pc, jc, kc, nc, packedB.data());
+
+            for (int ic = 0; ic < M; ic += MC) {
+                const int mc = std::min(MC, M - ic);
+                PackA(transA, A, lda, ic, pc, mc, kc, packedA.data());
+
+                for (int jr = 0; jr < nc; jr += NR) {
+                    const int n = std::min(NR, nc - jr);
+                    const Scalar* b = packedB.data() + jr * kc;
+                    for (int ir = 0; ir < mc; ir += MR) {
+                        const int m = std::min(MR, mc - ir);
+                        const Scalar* a = packedA.data() + ir * kc;
+                        simd.gemmTile(kc, a, b, acc);
+                        StoreTile(acc, m, n, ic + ir, jc + jr, alpha, beta, first, last, C, ldc, epilogue);
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include "Scalar.h"
+
+struct GemmEpilogue {
+    const Scalar* row_bias = nullptr;
+    const Scalar* col_bias = nullptr;
+    // one of the Simd() activations, run over each finished row of a tile
+    void (*activation)(int n, Scalar* x) = nullptr;
+};
+
+// C = alpha * op(A) * op(B) + beta * C for row-major matrices, where op(A) is M x K
+// and op(B) is K x N. The epilogue adds the biases and applies the activation to
+// the finished C, while the tile is still in cache.
+void Gemm(bool transA, bool transB, int M, int N, int K,
+    Scalar alpha, const Scalar* A, int lda, const Scalar* B, int ldb,
+    Scalar beta, Scalar* C, int ldc, const GemmEpilogue& epilogue = GemmEpilogue());
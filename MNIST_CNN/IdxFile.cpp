@@ -0,0 +1,40 @@
+#include "IdxFile.h"
+#include <stdexcept>
+
+namespace {
+    const uint8_t IDX_UNSIGNED_BYTE = 0x08;
+
+    int ReadBigEndian(const uint8_t* bytes)
+    {
+        return (int(bytes[0]) << 24) | (int(bytes[1]) << 16) | (int(bytes[2]) << 8) | int(bytes[3]);
+    }
+}
+
+IdxFile::IdxFile(const std::string& path) :
+    file(path)
+{
+    const uint8_t* base = file.data();
+    const size_t length = file.size();
+
+    // magic number: two zero bytes, the element type and the number of dimensions
+    if (length < 4 || base[0] != 0 || base[1] != 0 || base[2] != IDX_UNSIGNED_BYTE || base[3] == 0) {
+        throw std::runtime_error(path + " is not an unsigned byte IDX file");
+    }
+    const int rank = base[3];
+    const size_t headerSize = 4 + 4 * size_t(rank);
+    if (length < headerSize) {
+        throw std::runtime_error(path + " has a truncated IDX header");
+    }
+
+    size_t expected = 1;
+    for (int i = 0; i < rank; ++i) {
+        dims.push_back(ReadBigEndian(base + 4 + 4 * i));
+        expected *= dims.back();
+    }
+    if (length < headerSize + expected) {
+        throw std::runtime_error(path + " is shorter than its IDX header says");
+    }
+
+    item_size = dims[0] ? int(expected / dims[0]) : 0;
+    payload = base + headerSize;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "MappedFile.h"
+
+// Read-only memory mapping of an IDX file (the MNIST image/label format) holding
+// unsigned bytes. The header is validated once on open, after that items are handed
+// out as pointers straight into the mapping.
+class IdxFile
+{
+public:
+    explicit IdxFile(const std::string& path);
+    IdxFile(const IdxFile&) = delete;
+    void operator=(const IdxFile&) = delete;
+
+    int count() const { return dims[0]; }
+    int dim(int i) const { return dims[i]; }
+    int rank() const { return dims.size(); }
+    // bytes per item, the product of all dimensions but the first
+    int itemSize() const { return item_size; }
+    const uint8_t* item(int i) const { return payload + size_t(i) * item_size; }
+    const uint8_t* data() const { return payload; }
+private:
+    MappedFile file;
+    std::vector<int> dims;
+    int item_size = 0;
+    const uint8_t* payload = nullptr;
+};
@@ -0,0 +1,318 @@
+#include "InferenceServer.h"
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    const char CLASSIFY = 'C';
+    const char STATS = 'S';
+
+    typedef std::chrono::steady_clock Clock;
+
+    // false once the peer closed its end or the descriptor failed
+    bool ReadFully(int fd, void* data, size_t size)
+    {
+        char* bytes = static_cast<char*>(data);
+        while (size > 0) {
+#ifdef _WIN32
+            const int got = _read(fd, bytes, unsigned(size));
+#else
+            const ssize_t got = read(fd, bytes, size);
+#endif
+            if (got <= 0) {
+                return false;
+            }
+            bytes += got;
+            size -= got;
+        }
+        return true;
+    }
+
+    // Blocks until fd has something to read, waking up now and then to notice stopping:
+    // a blocked read would be restarted after the signal that asked the server to stop.
+    // False once stopping is set first.
+    bool WaitReadable(int fd, const std::atomic<bool>& stopping)
+    {
+#ifdef _WIN32
+        return !stopping;
+#else
+        pollfd poller = { fd, POLLIN, 0 };
+        while (!stopping) {
+            const int ready = poll(&poller, 1, 200);
+            if (ready > 0 || (ready < 0 && errno != EINTR)) {
+                // data, a hang-up or an error, the read that follows tells which
+                return true;
+            }
+        }
+        return false;
+#endif
+    }
+
+    bool WriteFully(int fd, const void* data, size_t size)
+    {
+        const char* bytes = static_cast<const char*>(data);
+        while (size > 0) {
+#ifdef _WIN32
+            const int put = _write(fd, bytes, unsigned(size));
+#else
+            const ssize_t put = write(fd, bytes, size);
+#endif
+            if (put <= 0) {
+                return false;
+            }
+            bytes += put;
+            size -= put;
+        }
+        return true;
+    }
+}
+
+InferenceServer::InferenceServer(const Model& model, const Options& options) :
+    model(model),
+    options(options),
+    startTime(Clock::now())
+{
+    assert(options.max_batch > 0 && options.threads > 0);
+    const Tensor::Size size = model.getInputSize();
+    pixelCount = size.height * size.width * size.depth;
+    classes = model.getClasses();
+    latencies.reserve(LATENCY_WINDOW);
+    for (int t = 0; t < options.threads; ++t) {
+        batchers.emplace_back(&InferenceServer::batchLoop, this);
+    }
+}
+
+InferenceServer::~InferenceServer()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        shutdown = true;
+    }
+    arrived.notify_all();
+    for (auto& batcher : batchers) {
+        batcher.join();
+    }
+}
+
+void InferenceServer::batchLoop()
+{
+    InferenceContext context = model.createContext(options.max_batch);
+    Tensor::Size size = model.getInputSize();
+    size.batch = options.max_batch;
+    Tensor input(size);
+    std::vector<Request*> batch;
+    batch.reserve(options.max_batch);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        arrived.wait(lock, [&] { return shutdown || !queue.empty(); });
+        if (shutdown) {
+            return;
+        }
+        // the oldest request sets the deadline, later ones only get to ride along
+        const Clock::time_point deadline = queue.front()->arrival + options.max_delay;
+        while (!shutdown && int(queue.size()) < options.max_batch && Clock::now() < deadline) {
+            arrived.wait_until(lock, deadline);
+        }
+        if (queue.empty()) {
+            // another batcher took them
+            continue;
+        }
+        const int n = std::min<int>(queue.size(), options.max_batch);
+        batch.assign(queue.begin(), queue.begin() + n);
+        queue.erase(queue.begin(), queue.begin() + n);
+        lock.unlock();
+
+        for (int s = 0; s < n; ++s) {
+            const uint8_t* pixels = batch[s]->pixels.data();
+            Scalar* sample = input.data(s);
+            for (int i = 0; i < pixelCount; ++i) {
+                sample[i] = pixels[i] / Scalar(255);
+            }
+        }
+        size.batch = n;
+        const Mat& out = model.predict(TensorView(input.data(), size), context);
+        for (int s = 0; s < n; ++s) {
+            std::copy(out.begin() + s * classes, out.begin() + (s + 1) * classes, batch[s]->probabilities.begin());
+        }
+
+        lock.lock();
+        const Clock::time_point now = Clock::now();
+        for (Request* request : batch) {
+            const double latency = std::chrono::duration<double, std::micro>(now - request->arrival).count();
+            if (int(latencies.size()) < LATENCY_WINDOW) {
+                latencies.push_back(latency);
+            }
+            else {
+                latencies[nextLatency] = latency;
+            }
+            nextLatency = (nextLatency + 1) % LATENCY_WINDOW;
+            request->done = true;
+        }
+        requests += n;
+        ++batches;
+        answered.notify_all();
+    }
+}
+
+void InferenceServer::classify(Request& request)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    request.arrival = Clock::now();
+    request.done = false;
+    queue.push_back(&request);
+    // a batcher waiting for its batch to fill needs the wake-up as much as an idle one
+    arrived.notify_all();
+    answered.wait(lock, [&] { return request.done; });
+}
+
+void InferenceServer::serveConnection(int in, int out)
+{
+    Request request;
+    request.pixels.resize(pixelCount);
+    request.probabilities.resize(classes);
+    char type;
+    while (WaitReadable(in, stopping) && ReadFully(in, &type, 1)) {
+        if (type == CLASSIFY) {
+            if (!ReadFully(in, request.pixels.data(), pixelCount)) {
+                break;
+            }
+            classify(request);
+            if (!WriteFully(out, request.probabilities.data(), classes * sizeof(float))) {
+                break;
+            }
+        }
+        else if (type == STATS) {
+            const std::string text = statsText();
+            const uint32_t length = text.size();
+            if (!WriteFully(out, &length, sizeof(length)) || !WriteFully(out, text.data(), text.size())) {
+                break;
+            }
+        }
+        else {
+            // out of step with the client, nothing after this can be trusted
+            break;
+        }
+    }
+}
+
+void InferenceServer::serveStream(int in, int out)
+{
+    serveConnection(in, out);
+}
+
+void InferenceServer::serveSocket(const std::string& path)
+{
+#ifdef _WIN32
+    throw std::runtime_error("serving on a Unix domain socket is not supported on this platform, serve stdin/stdout instead");
+#else
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("socket path " + path + " is too long");
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        throw std::runtime_error("cannot create a socket");
+    }
+    // a previous server that was killed leaves its socket file behind
+    unlink(path.c_str());
+    if (bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 64) != 0) {
+        close(listener);
+        throw std::runtime_error("cannot listen on " + path);
+    }
+
+    while (!stopping) {
+        // wakes up now and then to notice stop()
+        pollfd poller = { listener, POLLIN, 0 };
+        if (poll(&poller, 1, 200) > 0) {
+            const int fd = accept(listener, nullptr, nullptr);
+            if (fd >= 0) {
+                clients.emplace_back();
+                Client& client = clients.back();
+                client.fd = fd;
+                client.thread = std::thread([this, &client] {
+                    serveConnection(client.fd, client.fd);
+                    client.finished = true;
+                });
+            }
+        }
+        // descriptors are only closed after their thread is done with them
+        for (auto it = clients.begin(); it != clients.end();) {
+            if (it->finished) {
+                it->thread.join();
+                close(it->fd);
+                it = clients.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+    }
+
+    close(listener);
+    unlink(path.c_str());
+    for (auto& client : clients) {
+        // wakes a thread blocked reading its next request
+        ::shutdown(client.fd, SHUT_RDWR);
+        client.thread.join();
+        close(client.fd);
+    }
+    clients.clear();
+#endif
+}
+
+InferenceServer::Stats InferenceServer::getStats()
+{
+    std::vector<double> window;
+    Stats stats;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        window = latencies;
+        stats.requests = requests;
+        stats.batches = batches;
+    }
+    stats.mean_batch = stats.batches ? double(stats.requests) / stats.batches : 0;
+    const std::chrono::duration<double> uptime = Clock::now() - startTime;
+    stats.requests_per_sec = stats.requests / uptime.count();
+    stats.p50_us = 0;
+    stats.p99_us = 0;
+    if (!window.empty()) {
+        const size_t p50 = window.size() / 2;
+        const size_t p99 = std::min(window.size() - 1, window.size() * 99 / 100);
+        std::nth_element(window.begin(), window.begin() + p50, window.end());
+        stats.p50_us = window[p50];
+        std::nth_element(window.begin(), window.begin() + p99, window.end());
+        stats.p99_us = window[p99];
+    }
+    return stats;
+}
+
+std::string InferenceServer::statsText()
+{
+    const Stats stats = getStats();
+    std::ostringstream text;
+    text << "requests " << stats.requests << "\n"
+        << "batches " << stats.batches << "\n"
+        << "mean_batch " << stats.mean_batch << "\n"
+        << "p50_us " << stats.p50_us << "\n"
+        << "p99_us " << stats.p99_us << "\n"
+        << "requests_per_sec " << stats.requests_per_sec << "\n";
+    return text.str();
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include "Model.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Classifies images for other processes on the same host. Every connection sends one
+// request at a time and waits for the answer; the requests waiting on all connections
+// are coalesced into micro-batches of up to max_batch images, and a batch waits at most
+// max_delay after its oldest request arrived before it runs with what it has.
+//
+// Protocol, in native byte order:
+//   'C' followed by height * width bytes of pixels, row by row -> one float32 probability per class
+//   'S'                                                         -> uint32 length, then the counters as text
+class InferenceServer
+{
+public:
+    struct Options {
+        int max_batch = 32;
+        std::chrono::microseconds max_delay = std::chrono::microseconds(2000);
+        // threads running batches, each with its own InferenceContext
+        int threads = 1;
+    };
+    struct Stats {
+        long long requests;
+        long long batches;
+        double mean_batch;
+        // over the last LATENCY_WINDOW requests, from arrival to answer
+        double p50_us;
+        double p99_us;
+        double requests_per_sec;
+    };
+    static const int LATENCY_WINDOW = 8192;
+public:
+    // The model has to outlive the server
+    InferenceServer(const Model& model, const Options& options);
+    ~InferenceServer();
+    InferenceServer(const InferenceServer&) = delete;
+    void operator=(const InferenceServer&) = delete;
+
+    // Accepts connections on a Unix domain socket until stop()
+    void serveSocket(const std::string& path);
+    // Serves a single client over a pair of file descriptors, e.g. stdin and stdout,
+    // until it closes its end or stop()
+    void serveStream(int in, int out);
+    // Only sets a flag, so a signal handler may call it
+    void stop() { stopping = true; }
+    Stats getStats();
+private:
+    struct Request {
+        std::vector<uint8_t> pixels;
+        std::vector<float> probabilities;
+        std::chrono::steady_clock::time_point arrival;
+        bool done = false;
+    };
+    struct Client {
+        std::thread thread;
+        int fd;
+        std::atomic<bool> finished{ false };
+    };
+
+    void batchLoop();
+    void serveConnection(int in, int out);
+    // Queues the request and blocks until a batch answered it
+    void classify(Request& request);
+    std::string statsText();
+private:
+    const Model& model;
+    Options options;
+    int pixelCount;
+    int classes;
+    std::atomic<bool> stopping{ false };
+    std::chrono::steady_clock::time_point startTime;
+
+    std::mutex mutex;
+    // a request arrived, or the server shuts down
+    std::condition_variable arrived;
+    // a batch finished
+    std::condition_variable answered;
+    std::deque<Request*> queue;
+    bool shutdown = false;
+
+    long long requests = 0;
+    long long batches = 0;
+    std::vector<double> latencies;
+    int nextLatency = 0;
+
+    std::vector<std::thread> batchers;
+    std::list<Client> clients;
+};
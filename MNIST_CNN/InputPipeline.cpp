@@ -0,0 +1,165 @@
+#include "InputPipeline.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+
+namespace {
+    // Spins briefly, then yields, then naps: a producer that runs ahead or a consumer that
+    // runs dry should not take a core from the threads it is waiting for
+    template <typename Condition>
+    void WaitUntil(const Condition& condition)
+    {
+        for (int round = 0; !condition(); ++round) {
+            if (round < 64) {
+                continue;
+            }
+            if (round < 256) {
+                std::this_thread::yield();
+            }
+            else {
+                std::this_thread::sleep_for(std::chrono::microseconds(20));
+            }
+        }
+    }
+}
+
+InputPipeline::InputPipeline(const Tensor::Size& inputSize, int classes, int slotCount, int producerCount) :
+    inputSize(inputSize),
+    classes(classes)
+{
+    assert(slotCount > 0 && producerCount > 0);
+    for (int s = 0; s < slotCount; ++s) {
+        slots.push_back(std::make_unique<Slot>());
+    }
+    for (int k = 0; k < producerCount; ++k) {
+        producers.emplace_back(&InputPipeline::producerLoop, this, k);
+    }
+}
+
+InputPipeline::~InputPipeline()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    wake.notify_all();
+    for (auto& producer : producers) {
+        producer.join();
+    }
+}
+
+void InputPipeline::start(const DatasetView& samples, int start, int batch_size)
+{
+    assert(0 <= start && start < samples.size() && batch_size > 0);
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [&] { return busy == 0; });
+        this->samples = &samples;
+        first = start;
+        batchSize = batch_size;
+        batchCount = (samples.size() - start + batch_size - 1) / batch_size;
+        stalls = 0;
+        for (int s = 0; s < int(slots.size()); ++s) {
+            Batch& batch = slots[s]->batch;
+            if (batch.input.getRawSize() == 0) {
+                Tensor::Size size = inputSize;
+                size.batch = batch_size;
+                batch.input = Tensor(size);
+            }
+            slots[s]->ready = -1;
+            slots[s]->free = s;
+        }
+        busy = producers.size();
+        ++pass;
+    }
+    wake.notify_all();
+}
+
+void InputPipeline::augment(const Augmenter::Options& options)
+{
+    // the distortions work on single-channel images
+    assert(inputSize.depth == 1);
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [&] { return busy == 0; });
+    augmenters.clear();
+    std::random_device seed;
+    for (int k = 0; k < int(producers.size()); ++k) {
+        augmenters.push_back(std::make_unique<Augmenter>(options, inputSize.height, inputSize.width, seed()));
+    }
+}
+
+void InputPipeline::finish()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [&] { return busy == 0; });
+    samples = nullptr;
+}
+
+const InputPipeline::Batch& InputPipeline::acquire(int n)
+{
+    assert(0 <= n && n < batchCount);
+    Slot& slot = *slots[n % slots.size()];
+    if (slot.ready.load(std::memory_order_acquire) != n) {
+        ++stalls;
+        WaitUntil([&] { return slot.ready.load(std::memory_order_acquire) == n; });
+    }
+    return slot.batch;
+}
+
+void InputPipeline::release(int n)
+{
+    slots[n % slots.size()]->free.store(n + int(slots.size()), std::memory_order_release);
+}
+
+void InputPipeline::producerLoop(int k)
+{
+    unsigned long long seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stop || pass != seen; });
+            if (stop) {
+                return;
+            }
+            seen = pass;
+        }
+
+        for (int n = k; n < batchCount; n += producers.size()) {
+            Slot& slot = *slots[n % slots.size()];
+            WaitUntil([&] { return slot.free.load(std::memory_order_acquire) >= n; });
+            const int begin = first + n * batchSize;
+            fill(k, slot.batch, begin, std::min(begin + batchSize, samples->size()));
+            slot.ready.store(n, std::memory_order_release);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --busy;
+        }
+        idle.notify_all();
+    }
+}
+
+void InputPipeline::fill(int k, Batch& batch, int begin, int end)
+{
+    const int count = end - begin;
+    const int pixels = inputSize.height * inputSize.width * inputSize.depth;
+    PROFILE_SCOPE("InputPipeline.fill", 0, double(count) * pixels * (1 + sizeof(Scalar)));
+    batch.begin = begin;
+    batch.input.setBatch(count);
+    batch.labels.assign(count * classes, 0);
+    for (int n = 0; n < count; ++n) {
+        const uint8_t* image = samples->image(begin + n);
+        Scalar* input = batch.input.data(n);
+        if (!augmenters.empty()) {
+            augmenters[k]->apply(image, input);
+        }
+        else {
+            for (int i = 0; i < pixels; ++i) {
+                input[i] = image[i] / Scalar(255);
+            }
+        }
+        batch.labels[n * classes + samples->label(begin + n)] = 1;
+    }
+}
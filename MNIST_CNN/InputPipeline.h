@@ -0,0 +1,83 @@
+#pragma once
+#include "Augmenter.h"
+#include "Dataset.h"
+#include "Tensor.h"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Prepares training batches on background threads while the network trains on earlier
+// ones. A pass is cut into batches numbered from 0 in sample order; producer k fills
+// batches k, k + producers, ... into a fixed ring of slots, converting the pixels to
+// scalars in [0, 1] and the labels to one-hot rows. Handing a batch over and back only
+// takes an atomic store and load per slot, and the slots keep their buffers from pass
+// to pass, so a pass allocates nothing once the first one sized them. With augmentation on,
+// every producer distorts the images it converts with an Augmenter of its own.
+class InputPipeline
+{
+public:
+    struct Batch {
+        // samples [begin, begin + input.batch()) of the pass
+        int begin;
+        Tensor input;
+        // input.batch() x classes
+        Mat labels;
+    };
+public:
+    InputPipeline(const Tensor::Size& inputSize, int classes, int slots, int producers = 1);
+    ~InputPipeline();
+    InputPipeline(const InputPipeline&) = delete;
+    void operator=(const InputPipeline&) = delete;
+
+    // Starts producing the batches of samples [start, samples.size()) in steps of
+    // batch_size. samples must stay valid until finish().
+    void start(const DatasetView& samples, int start, int batch_size);
+    // Waits for the producers to stop touching the samples of the pass
+    void finish();
+    // Distorts the images of every later pass; call it between passes
+    void augment(const Augmenter::Options& options);
+    int getBatchCount() const { return batchCount; }
+    int getSlotCount() const { return slots.size(); }
+
+    // Batch n of the pass, waiting for it if the producers are behind. Every batch is
+    // acquired by exactly one consumer, and stays valid until it releases it.
+    const Batch& acquire(int n);
+    void release(int n);
+    // acquire() calls of the pass that found their batch not ready yet
+    int getStalls() const { return stalls; }
+private:
+    struct Slot {
+        Batch batch;
+        // number of the batch the slot holds once it is filled
+        std::atomic<int> ready{ -1 };
+        // lowest batch number that may be filled into the slot
+        std::atomic<int> free{ 0 };
+    };
+
+    void producerLoop(int k);
+    void fill(int k, Batch& batch, int begin, int end);
+private:
+    Tensor::Size inputSize;
+    int classes;
+    std::vector<std::unique_ptr<Slot>> slots;
+    std::vector<std::thread> producers;
+    // one per producer, empty without augmentation
+    std::vector<std::unique_ptr<Augmenter>> augmenters;
+
+    // the pass, written by start() while every producer is idle
+    const DatasetView* samples = nullptr;
+    int first = 0;
+    int batchSize = 0;
+    int batchCount = 0;
+    std::atomic<int> stalls{ 0 };
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    unsigned long long pass = 0;
+    int busy = 0;
+    bool stop = false;
+};
@@ -1,20 +1,16 @@
 #include "Layer.h"
+#include "Gemm.h"
+#include "Simd.h"
 #include <cassert>
 #include <random>
+#include <algorithm>
 
 SoftmaxLayer::SoftmaxLayer(int input_num, int output_num)
 {
+    inputSize = input_num;
+    outputSize = output_num;
     out.resize(output_num);
     dL_dX.resize(input_num);
-    bias.resize(output_num);
-
-    weights.resize(output_num, Mat(input_num));
-    for (int i = 0; i < weights.size(); ++i) {
-        bias[i] = 0;
-        for (int j = 0; j < weights[0].size(); ++j) {
-            weights[i][j] = NRand(0,2.f/input_num);
-        }
-    }
 }
 
 void SoftmaxLayer::feedForward(const DenseLayer& prevLayer)
@@ -22,105 +18,75 @@ void SoftmaxLayer::feedForward(const DenseLayer& prevLayer)
     feedForward(prevLayer.getOut());
 }
 
-void SoftmaxLayer::feedForward(const Mat& input)
+void SoftmaxLayer::feedForward(const Scalar* input, int batch)
 {
+    this->batch = batch;
     X = input;
-    const int INPUT_SIZE = weights[0].size();
-    const int OUTPUT_SIZE = weights.size();
-
-    assert(input.size() == INPUT_SIZE);
 
-    out = Mat(OUTPUT_SIZE);
-    for (int i = 0; i < OUTPUT_SIZE; ++i) {
-        out[i] += bias[i];
-        for (int j = 0; j < INPUT_SIZE; ++j) {
-            out[i] += weights[i][j] * X[j];
+    GemmEpilogue epilogue;
+    epilogue.col_bias = bias;
+    out.resize(batch * outputSize);
+    Gemm(false, true, batch, outputSize, inputSize, 1, X, inputSize, weights, inputSize, 0, out.data(), outputSize, epilogue);
+
+    for (int n = 0; n < batch; ++n) {
+        Scalar* row = out.data() + n * outputSize;
+        // shifted by the largest logit: float's exp overflows past 88, and inf / inf is NaN
+        const Scalar max = *std::max_element(row, row + outputSize);
+        const Scalar sum = Simd().expSum(outputSize, max, row);
+        for (int i = 0; i < outputSize; ++i) {
+            row[i] /= sum;
         }
     }
-
-    double sum = 0;
-    for (int i = 0; i < OUTPUT_SIZE; ++i) {
-        out[i] = exp(out[i]);
-        sum += out[i];
-    }
-
-    for (int i = 0; i < OUTPUT_SIZE; ++i) {
-        out[i] /= sum;
-    }
 }
 
-void SoftmaxLayer::backProp(const std::vector<double>& y, double alpha)
+void SoftmaxLayer::backProp(const std::vector<Scalar>& y)
 {
     assert(out.size() == y.size());
-    const int OUTPUT_SIZE = weights.size();
-    const int INPUT_SIZE = weights[0].size();
-
-    Mat2 dL_dW(OUTPUT_SIZE, Mat(INPUT_SIZE));
-    Mat dL_dX(INPUT_SIZE);
-    Mat dL_dZ(OUTPUT_SIZE);
-    for (int j = 0; j < OUTPUT_SIZE; ++j) {
-        dL_dZ[j] = out[j] - y[j];
-        for (int i = 0; i < INPUT_SIZE; ++i) {
-            dL_dX[i] += weights[j][i] * dL_dZ[j];
-            dL_dW[j][i] = X[i] * dL_dZ[j];
-        }
-    }
-
-    //update weights 
-    for (int i = 0; i < OUTPUT_SIZE; ++i) {
-        bias[i] -= alpha * dL_dZ[i];
-        for (int j = 0; j < INPUT_SIZE; ++j) {
-            weights[i][j] -= alpha * dL_dW[i][j];
 
-        }
+    Scalar* dL_dZ = workspace->allocate(batch * outputSize);
+    for (int i = 0; i < batch * outputSize; ++i) {
+        dL_dZ[i] = out[i] - y[i];
+    }
+    std::fill(dL_db, dL_db + outputSize, Scalar(0));
+    for (int n = 0; n < batch; ++n) {
+        Simd().axpy(outputSize, 1, dL_dZ + n * outputSize, dL_db);
     }
 
+    // dL_dW = dL_dZ^T * X, dL_dX = dL_dZ * W; both read W and X along their rows
+    dL_dX.resize(batch * inputSize);
+    Gemm(true, false, outputSize, inputSize, batch, 1, dL_dZ, outputSize, X, inputSize, 0, dL_dW, inputSize);
+    Gemm(false, false, batch, inputSize, outputSize, 1, dL_dZ, outputSize, weights, inputSize, 0, dL_dX.data(), inputSize);
 }
 
 DenseLayer::DenseLayer(int input_size, int output_size, EActivation activation_func)
 {
+    inputSize = input_size;
+    outputSize = output_size;
     out.resize(output_size);
-    X.resize(input_size);
     dL_dX.resize(input_size);
-    bias.resize(output_size);
-
-    weights.resize(output_size, Mat(input_size));
-    for (int i = 0; i < output_size; ++i) {
-        bias[i] = 0;
-        for (int j = 0; j < input_size; ++j) {
-            weights[i][j] = NRand(0, 2.f/input_size);
-        }
-    }
 
     switch (activation_func) {
     case EActivation::SIGMOID:
-        activation = Sigmoid;
-        derivActivation = SigmoidDeriv;
+        activation = Simd().sigmoid;
+        activationBackward = Simd().sigmoidBackward;
         break;
     case EActivation::ReLU:
-        activation = ReLU;
-        derivActivation = ReluDeriv;
+        activation = Simd().relu;
+        activationBackward = Simd().reluBackward;
         break;
     }
 }
 
-void DenseLayer::feedForward(const Mat& input)
+void DenseLayer::feedForward(const Scalar* input, int batch)
 {
+    this->batch = batch;
     X = input;
 
-    assert(input.size() == weights[0].size());
-    assert(out.size() == weights.size());
-    out = Mat(weights.size());
-    for (int i = 0; i < weights.size(); ++i) {
-        out[i] += bias[i];
-        for (int j = 0; j < weights[0].size(); ++j) {
-            out[i] += weights[i][j] * input[j];
-        }
-    }
-
-    for (int i = 0; i < out.size(); ++i) {
-        out[i] = activation(out[i]);
-    }
+    GemmEpilogue epilogue;
+    epilogue.col_bias = bias;
+    epilogue.activation = activation;
+    out.resize(batch * outputSize);
+    Gemm(false, true, batch, outputSize, inputSize, 1, X, inputSize, weights, inputSize, 0, out.data(), outputSize, epilogue);
 }
 
 void DenseLayer::feedForward(const DenseLayer& prevLayer)
@@ -128,43 +94,48 @@ void DenseLayer::feedForward(const DenseLayer& prevLayer)
     feedForward(prevLayer.getOut());
 }
 
-void DenseLayer::backProp(const Mat& dL_dA, double alpha)
+void DenseLayer::backProp(const Mat& dL_dA)
 {
-    const int INPUT_SIZE = weights[0].size();
-    const int OUTPUT_SIZE = weights.size();
-
-    assert(dL_dA.size() == OUTPUT_SIZE);
-
-    Mat2 dL_dW(OUTPUT_SIZE, Mat(INPUT_SIZE));
-    Mat dL_dX(INPUT_SIZE);
-    Mat dL_dZ(dL_dA.size());
-    for (int j = 0; j < OUTPUT_SIZE; ++j) {
-        dL_dZ[j] = dL_dA[j] * derivActivation(out[j]);
-        for (int i = 0; i < INPUT_SIZE; ++i) {
-            dL_dX[i] += weights[j][i] * dL_dZ[j];
-            dL_dW[j][i] = X[i] * dL_dZ[j];
-        }
-    }
+    assert(dL_dA.size() == batch * outputSize);
 
-    //update weights
-    for (int i = 0; i < OUTPUT_SIZE; ++i) {
-        bias[i] -= alpha * dL_dZ[i];
-        for (int j = 0; j < INPUT_SIZE; ++j) {
-            weights[i][j] -= alpha * dL_dW[i][j];
-        }
+    Scalar* dL_dZ = workspace->allocate(batch * outputSize);
+    activationBackward(batch * outputSize, dL_dA.data(), out.data(), dL_dZ);
+    std::fill(dL_db, dL_db + outputSize, Scalar(0));
+    for (int n = 0; n < batch; ++n) {
+        Simd().axpy(outputSize, 1, dL_dZ + n * outputSize, dL_db);
     }
+
+    // dL_dW = dL_dZ^T * X, dL_dX = dL_dZ * W; both read W and X along their rows
+    dL_dX.resize(batch * inputSize);
+    Gemm(true, false, outputSize, inputSize, batch, 1, dL_dZ, outputSize, X, inputSize, 0, dL_dW, inputSize);
+    Gemm(false, false, batch, inputSize, outputSize, 1, dL_dZ, outputSize, weights, inputSize, 0, dL_dX.data(), inputSize);
+}
+
+int Layer::getParamCount() const
+{
+    return outputSize * inputSize + outputSize;
+}
+
+void Layer::bindParams(Scalar* params, Scalar* grads)
+{
+    weights = params;
+    bias = params + outputSize * inputSize;
+    dL_dW = grads;
+    dL_db = grads ? grads + outputSize * inputSize : nullptr;
 }
 
-Tensor Layer::getTensorDlDx(const Tensor::Size& tensor_size) const
+void Layer::initParams()
 {
-    Tensor tensor(tensor_size);
-    int hw = tensor_size.height * tensor_size.width;
-    for (int d = 0; d < tensor_size.depth; ++d) {
-        for (int i = 0; i < tensor_size.height; ++i) {
-            for (int j = 0; j < tensor_size.width; ++j) {
-                tensor(i, j, d) = dL_dX[d * hw + tensor_size.width * i + j];
-            }
+    for (int i = 0; i < outputSize; ++i) {
+        bias[i] = 0;
+        for (int j = 0; j < inputSize; ++j) {
+            weights[i * inputSize + j] = NRand(0, 2.f/inputSize);
         }
     }
-    return tensor;
+}
+
+int Layer::getWorkspaceSize(int batch) const
+{
+    // dL_dZ
+    return Workspace::roundUp(batch * outputSize);
 }
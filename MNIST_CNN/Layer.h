@@ -1,7 +1,9 @@
 #pragma once
 #include <iostream>
 #include <functional>
+#include <memory>
 #include "Math.h"
+#include "Workspace.h"
 
 class Layer {
 public:
@@ -12,37 +14,70 @@ public:
         EActivation activation_func;
     };
 public:
-    virtual void feedForward(const Mat& X) = 0;
-    virtual void backProp(const Mat& dL_dA, double alpha) = 0;
+    virtual ~Layer() {}
+    // X, out and dL_dX hold one row per sample of the batch; X is not copied and must stay
+    // valid until backProp
+    virtual void feedForward(const Scalar* X, int batch) = 0;
+    void feedForward(const Mat& X) { feedForward(X.data(), X.size() / inputSize); }
+    // Writes the parameter gradients of the last batch into the bound gradient storage
+    virtual void backProp(const Mat& dL_dA) = 0;
+    // Copy with its own activation buffers; it stays bound to the same storage until rebound
+    virtual std::unique_ptr<Layer> clone() const = 0;
+
+    // Parameters and gradients live in flat buffers owned by the Net, layers only point into
+    // them; grads is null for layers that only run forward passes
+    virtual int getParamCount() const;
+    virtual void bindParams(Scalar* params, Scalar* grads);
+    virtual void initParams();
+
+    // Scalars backProp carves out of the workspace for the given batch size
+    virtual int getWorkspaceSize(int batch) const;
+    void bindWorkspace(Workspace* workspace) { this->workspace = workspace; }
 
     const Mat& getOut() const { return out; }
-    Tensor getTensorDlDx(const Tensor::Size& tensor_size) const;
     const Mat& getDlDx() const { return dL_dX; }
+    int getBatch() const { return batch; }
+    int getInputSize() const { return inputSize; }
+    int getOutputSize() const { return outputSize; }
 protected:
-    Mat2 weights;
+    int inputSize = 0;
+    int outputSize = 0;
+    int batch = 1;
+    // output_size x input_size, row-major
+    Scalar* weights = nullptr;
+    Scalar* bias = nullptr;
+    Scalar* dL_dW = nullptr;
+    Scalar* dL_db = nullptr;
+    Workspace* workspace = nullptr;
     Mat out;
     Mat dL_dX;
-    Mat X;
-    Mat bias;
+    // input of the last forward pass, read again by backProp; the previous layer's output
+    // or the network input stays put until then
+    const Scalar* X = nullptr;
 };
 
 class DenseLayer : public Layer{
 public:
     DenseLayer(int input_size, int output_size, EActivation activation_func);
 
-    void feedForward(const Mat& input) override;
-    void backProp(const Mat& dL_dA, double alpha) override;
+    using Layer::feedForward;
+    void feedForward(const Scalar* input, int batch) override;
+    void backProp(const Mat& dL_dA) override;
     void feedForward(const DenseLayer& prevLayer);
+    std::unique_ptr<Layer> clone() const override { return std::make_unique<DenseLayer>(*this); }
 private:
-    std::function<double(double)> activation;
-    std::function<double(double)> derivActivation;
+    // Simd() kernels of the activation function, run over whole rows
+    void (*activation)(int n, Scalar* x) = nullptr;
+    void (*activationBackward)(int n, const Scalar* dA, const Scalar* out, Scalar* dZ) = nullptr;
 };
 
 class SoftmaxLayer : public Layer {
 public:
     SoftmaxLayer(int input_num, int output_num);
+    using Layer::feedForward;
     void feedForward(const DenseLayer& prevLayer);
-    void feedForward(const Mat& input) override;
-    void backProp(const Mat& ground_truth, double alpha) override;
+    void feedForward(const Scalar* input, int batch) override;
+    void backProp(const Mat& ground_truth) override;
+    std::unique_ptr<Layer> clone() const override { return std::make_unique<SoftmaxLayer>(*this); }
 private:
 };
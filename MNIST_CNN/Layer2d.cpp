@@ -1,5 +1,52 @@
 #include "Layer2d.h"
+#include "Gemm.h"
+#include "Simd.h"
 #include <cassert>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+
+namespace {
+    Mat RandomValues(int count, std::mt19937& gen)
+    {
+        std::uniform_real_distribution<Scalar> dist(-1, 1);
+        Mat values(count);
+        for (Scalar& x : values) {
+            x = dist(gen);
+        }
+        return values;
+    }
+
+    // Largest difference from the reference, relative to the reference's magnitude once that
+    // exceeds 1; infinite when a value was left NaN
+    double MaxError(const Scalar* values, const Scalar* reference, int count)
+    {
+        double maxError = 0;
+        double maxValue = 0;
+        for (int i = 0; i < count; ++i) {
+            if (std::isnan(values[i])) {
+                return std::numeric_limits<double>::infinity();
+            }
+            maxError = std::max<double>(maxError, std::abs(values[i] - reference[i]));
+            maxValue = std::max<double>(maxValue, std::abs(reference[i]));
+        }
+        return maxError / std::max(1.0, maxValue);
+    }
+}
+
+const char* ToString(EConvAlgorithm algorithm)
+{
+    switch (algorithm) {
+    case EConvAlgorithm::Direct:
+        return "direct";
+    case EConvAlgorithm::Im2col:
+        return "im2col";
+    case EConvAlgorithm::Winograd:
+        return "winograd";
+    }
+    return "unknown";
+}
 
 Conv2d::Conv2d(const Tensor::Size& inSize, EActivation activation_func, int kernel_num, int stride, int padding, int kernel_dim)
 {
@@ -12,123 +59,339 @@ Conv2d::Conv2d(const Tensor::Size& inSize, EActivation activation_func, int kern
     outputSize.depth = kernel_num;
     outputSize.height = (inputSize.height + 2 * padding - kernel_dim) / stride + 1;
     outputSize.width = (inputSize.width + 2 * padding - kernel_dim) / stride + 1;
+    convSize = outputSize;
 
-    kernels.resize(kernel_num, Tensor(kernel_dim, kernel_dim, inSize.depth));
-    dL_dK.resize(kernel_num, Tensor(kernel_dim, kernel_dim, inSize.depth));
-
-    bias.resize(kernel_num);
-    dL_db.resize(kernel_num);
+    col.resize(inSize.depth * kernel_dim * kernel_dim * outputSize.height * outputSize.width);
 
     dL_dX = Tensor(inputSize);
     out = Tensor(outputSize);
 
     switch (activation_func) {
     case EActivation::ReLU:
-        activation = ReLU;
-        derivActivation = ReluDeriv;
+        activation = Simd().relu;
+        activationBackward = Simd().reluBackward;
         break;
     case EActivation::SIGMOID:
-        activation = Sigmoid;
-        derivActivation = SigmoidDeriv;
+        activation = Simd().sigmoid;
+        activationBackward = Simd().sigmoidBackward;
         break;
     }
+}
 
-    for (int n = 0; n < kernels.size(); ++n) {
+int Conv2d::getParamCount() const
+{
+    return kernel_num * inputSize.depth * kernel_dim * kernel_dim + kernel_num;
+}
+
+void Conv2d::bindParams(Scalar* params, Scalar* grads)
+{
+    const int kernelsSize = kernel_num * inputSize.depth * kernel_dim * kernel_dim;
+    kernels = params;
+    bias = params + kernelsSize;
+    dL_dK = grads;
+    dL_db = grads ? grads + kernelsSize : nullptr;
+    kernelsChanged = true;
+}
+
+int Conv2d::getWorkspaceSize(int batch) const
+{
+    const int patch = inputSize.depth * kernel_dim * kernel_dim;
+    const int area = convSize.height * convSize.width;
+    // dL_dZ for the batch, dL_dCol for one sample
+    return Workspace::roundUp(batch * kernel_num * area) + Workspace::roundUp(patch * area);
+}
+
+double Conv2d::getMacs() const
+{
+    return double(convSize.height) * convSize.width * kernel_num * inputSize.depth * kernel_dim * kernel_dim;
+}
+
+void Conv2d::initParams()
+{
+    const int patch = inputSize.depth * kernel_dim * kernel_dim;
+    for (int n = 0; n < kernel_num; ++n) {
         bias[n] = 0.01;
-        for (int d = 0; d < kernels[0].depth(); ++d) {
-            for (int i = 0; i < kernels[0].height(); ++i) {
-                for (int j = 0; j < kernels[0].width(); ++j) {
-                    kernels[n](i, j, d) = NRand(0, 2.f/(kernel_dim * kernel_dim));
-                }
-            }
+        for (int i = 0; i < patch; ++i) {
+            kernels[n * patch + i] = NRand(0, 2.f/(kernel_dim * kernel_dim));
         }
     }
+    kernelsChanged = true;
+}
 
+bool Conv2d::supportsForward(EConvAlgorithm algorithm) const
+{
+    switch (algorithm) {
+    case EConvAlgorithm::Direct:
+    case EConvAlgorithm::Im2col:
+        return true;
+    case EConvAlgorithm::Winograd:
+        return Winograd::supports(kernel_dim, kernel_stride);
+    }
+    return false;
 }
 
-void Conv2d::feedForward(const Layer2d& prevLayer)
+bool Conv2d::supportsBackward(EConvAlgorithm algorithm) const
 {
-    X = prevLayer.getOut();
+    return algorithm == EConvAlgorithm::Direct || algorithm == EConvAlgorithm::Im2col;
+}
 
-    for (int k = 0; k < kernel_num; ++k) {
-        Tensor convolved = Conv(X, kernels[k], kernel_stride, kernel_padding) + bias[k];
-        out.copy(convolved, 0, k);
+void Conv2d::setAlgorithms(EConvAlgorithm forward, EConvAlgorithm backward)
+{
+    assert(supportsForward(forward) && supportsBackward(backward));
+    forwardAlgorithm = forward;
+    backwardAlgorithm = backward;
+    if (forward == EConvAlgorithm::Winograd) {
+        winograd = Winograd(inputSize, kernel_num, kernel_dim, kernel_padding);
+        kernelsChanged = true;
+    }
+    else {
+        winograd = Winograd();
     }
+}
 
-    for (int i = 0; i < out.getRawSize(); ++i) {
-        out[i] = activation(out[i]);
+void Conv2d::prepareForward(const TensorView& input)
+{
+    assert(input.isContiguous());
+    this->input = input;
+
+    const int patch = inputSize.depth * kernel_dim * kernel_dim;
+    const int area = convSize.height * convSize.width;
+    if (keepsCol()) {
+        col.resize(input.batch() * patch * area);
+    }
+    else if (forwardAlgorithm == EConvAlgorithm::Im2col || backwardAlgorithm == EConvAlgorithm::Im2col) {
+        col.resize(patch * area);
+    }
+    if (forwardAlgorithm == EConvAlgorithm::Winograd && kernelsChanged) {
+        winograd.transformKernels(kernels);
+        kernelsChanged = false;
     }
 }
 
+void Conv2d::convolve(int n, Scalar* output)
+{
+    const int patch = inputSize.depth * kernel_dim * kernel_dim;
+    const int area = convSize.height * convSize.width;
 
-void Conv2d::setOutput(const Tensor& tensor)
+    switch (forwardAlgorithm) {
+    case EConvAlgorithm::Winograd:
+        winograd.forward(input.data(n), bias, activation, output);
+        break;
+    case EConvAlgorithm::Direct: {
+        const TensorView sample = input.sample(n);
+        const Tensor::Size kernelSize = { kernel_dim, kernel_dim, inputSize.depth };
+        for (int k = 0; k < kernel_num; ++k) {
+            Scalar* plane = output + k * area;
+            Conv(sample, TensorView(kernels + k * patch, kernelSize), kernel_stride, kernel_padding, plane);
+            for (int i = 0; i < area; ++i) {
+                plane[i] += bias[k];
+            }
+            activation(area, plane);
+        }
+        break;
+    }
+    case EConvAlgorithm::Im2col: {
+        GemmEpilogue epilogue;
+        epilogue.row_bias = bias;
+        epilogue.activation = activation;
+        Scalar* sampleCol = col.data() + (keepsCol() ? n * patch * area : 0);
+        Im2col(input.data(n), inputSize, kernel_dim, kernel_stride, kernel_padding, sampleCol);
+        Gemm(false, false, kernel_num, area, patch, 1, kernels, patch, sampleCol, area, 0, output, area, epilogue);
+        break;
+    }
+    }
+}
+
+void Conv2d::feedForward(const TensorView& input)
 {
-    out = tensor;
-    outputSize = tensor.getSize();
-    inputSize = tensor.getSize();
+    prepareForward(input);
+    out.setBatch(input.batch());
+    for (int n = 0; n < input.batch(); ++n) {
+        convolve(n, out.data(n));
+    }
 }
 
 
-void Conv2d::backProp(const Tensor& dL_dA, double alpha)
+void Conv2d::backProp(const TensorView& dL_dA)
 {
-    assert(dL_dA.depth() == kernel_num);
-    assert(Z.getRawSize() == dL_dA.getRawSize());
+    assert(dL_dA.depth() == kernel_num && dL_dA.batch() == out.batch());
 
-    Tensor dL_dZ = dL_dA;
-    for (int i = 0; i < dL_dA.getRawSize(); ++i) {
-        dL_dZ[i] = dL_dA[i] * derivActivation(out[i]);
-    }
+    Scalar* dL_dZ = workspace->allocate(out.getRawSize());
+    activationBackward(out.getRawSize(), dL_dA.data(), out.data(), dL_dZ);
+    backPropConv(dL_dZ, out.batch());
+}
 
-    for (int k = 0; k < kernel_num; ++k) {
-        for (int c = 0; c < inputSize.depth; ++c) {
-            Tensor convolved(inputSize);
-            convolved = Conv(X(c), dL_dZ(k), kernel_stride, kernel_padding);
-            dL_dK[k].set(convolved, c);
+void Conv2d::backPropConv(const Scalar* dL_dZ, int batch)
+{
+    const int patch = inputSize.depth * kernel_dim * kernel_dim;
+    const int area = convSize.height * convSize.width;
+
+    dL_dX.setBatch(batch);
+    std::fill(dL_db, dL_db + kernel_num, Scalar(0));
+    if (backwardAlgorithm == EConvAlgorithm::Direct) {
+        std::fill(dL_dK, dL_dK + kernel_num * patch, Scalar(0));
+        for (int n = 0; n < batch; ++n) {
+            backPropDirect(n, dL_dZ + n * kernel_num * area);
         }
+        return;
     }
 
+    Scalar* dL_dCol = workspace->allocate(patch * area);
+    for (int n = 0; n < batch; ++n) {
+        const Scalar* sampleCol = col.data() + n * patch * area;
+        if (!keepsCol()) {
+            Im2col(input.data(n), inputSize, kernel_dim, kernel_stride, kernel_padding, col.data());
+            sampleCol = col.data();
+        }
+        const Scalar* sampleDlDz = dL_dZ + n * kernel_num * area;
 
-    assert(dL_dK[0].depth() == inputSize.depth);
+        // dL_dK += dL_dZ * col^T
+        Gemm(false, true, kernel_num, patch, area, 1, sampleDlDz, area, sampleCol, area, n == 0 ? 0 : 1, dL_dK, patch);
 
-    int pad = kernel_dim - 1 - kernel_padding;
+        // dL_dCol = kernels^T * dL_dZ, folded back onto the input positions it was gathered from
+        Gemm(true, false, patch, area, kernel_num, 1, kernels, patch, sampleDlDz, area, 0, dL_dCol, area);
+        Col2im(dL_dCol, inputSize, kernel_dim, kernel_stride, kernel_padding, dL_dX.data(n));
 
-    for (int c = 0; c < inputSize.depth; ++c) {
-        Tensor dL_dXc(inputSize.height, inputSize.width, 1);
         for (int k = 0; k < kernel_num; ++k) {
-            dL_dXc += Conv(dL_dZ(k), kernels[k](c).turn180(), kernel_stride, pad);
+            dL_db[k] += Simd().sum(area, sampleDlDz + k * area);
         }
-        dL_dX.set(dL_dXc, c);
     }
+}
+
+void Conv2d::backPropDirect(int n, const Scalar* dL_dZ)
+{
+    const int height = inputSize.height;
+    const int width = inputSize.width;
+    const int outHeight = convSize.height;
+    const int outWidth = convSize.width;
+    const Scalar* img = input.data(n);
+    Scalar* dX = dL_dX.data(n);
+    std::fill(dX, dX + inputSize.depth * height * width, Scalar(0));
 
-    assert(dL_dZ.depth() == dL_db.size());
     for (int k = 0; k < kernel_num; ++k) {
-        for (int i = 0; i < dL_dZ.height(); ++i) {
-            for (int j = 0; j < dL_dZ.width(); ++j) {
-                dL_db[k] += dL_dZ(i, j, k);
+        const Scalar* dZ = dL_dZ + k * outHeight * outWidth;
+        dL_db[k] += Simd().sum(outHeight * outWidth, dZ);
+
+        for (int c = 0; c < inputSize.depth; ++c) {
+            const Scalar* channel = img + c * height * width;
+            Scalar* dChannel = dX + c * height * width;
+            for (int i = 0; i < kernel_dim; ++i) {
+                for (int j = 0; j < kernel_dim; ++j) {
+                    const int w = ((k * inputSize.depth + c) * kernel_dim + i) * kernel_dim + j;
+                    const Scalar weight = kernels[w];
+                    const int x0 = j - kernel_padding;
+                    // outputs whose input column stays inside the image
+                    const int xBegin = std::max(0, (kernel_padding - j + kernel_stride - 1) / kernel_stride);
+                    const int xEnd = std::min(outWidth, (width + kernel_padding - j + kernel_stride - 1) / kernel_stride);
+
+                    Scalar grad = 0;
+                    for (int y = 0; y < outHeight; ++y) {
+                        const int y0 = kernel_stride * y + i - kernel_padding;
+                        if (y0 < 0 || y0 >= height) {
+                            continue;
+                        }
+                        const Scalar* dZRow = dZ + y * outWidth;
+                        const Scalar* row = channel + y0 * width;
+                        Scalar* dRow = dChannel + y0 * width;
+                        for (int x = xBegin; x < xEnd; ++x) {
+                            grad += dZRow[x] * row[kernel_stride * x + x0];
+                            dRow[kernel_stride * x + x0] += weight * dZRow[x];
+                        }
+                    }
+                    dL_dK[w] += grad;
+                }
             }
         }
     }
+}
 
-    //update weights
-    for (int k = 0; k < kernel_num; ++k) {
-        bias[k] -= alpha * dL_db[k];
-        dL_db[k] = 0;
-        for (int c = 0; c < inputSize.depth; ++c) {
-            for (int n = 0; n < kernel_dim; ++n) {
-                for (int m = 0; m < kernel_dim; ++m) {
-                    kernels[k](n, m, c) -= alpha * dL_dK[k](n, m, c);
-                    dL_dK[k](n, m, c) = 0;
+ConvPool2d::ConvPool2d(const Tensor::Size& inSize, EActivation activation_func, int kernel_num, int stride, int padding, int kernel_dim, int pool_dim) :
+    Conv2d(inSize, activation_func, kernel_num, stride, padding, kernel_dim),
+    pool_dim(pool_dim)
+{
+    assert(pool_dim * pool_dim <= 256);
+    outputSize.height = (convSize.height - pool_dim) / pool_dim + 1;
+    outputSize.width = (convSize.width - pool_dim) / pool_dim + 1;
+    out = Tensor(outputSize);
+    conv.resize(kernel_num * convSize.height * convSize.width);
+}
+
+int ConvPool2d::getWorkspaceSize(int batch) const
+{
+    // the convolution's buffers and the gradient at the pooled output
+    return Conv2d::getWorkspaceSize(batch) + Workspace::roundUp(batch * outputSize.height * outputSize.width * kernel_num);
+}
+
+void ConvPool2d::feedForward(const TensorView& input)
+{
+    const int batch = input.batch();
+    const int area = convSize.height * convSize.width;
+
+    prepareForward(input);
+    out.setBatch(batch);
+    argmax.resize(out.getRawSize());
+
+    for (int n = 0; n < batch; ++n) {
+        convolve(n, conv.data());
+
+        Scalar* pooled = out.data(n);
+        uint8_t* index = argmax.data() + n * out.sampleSize();
+        for (int k = 0; k < kernel_num; ++k) {
+            const Scalar* plane = conv.data() + k * area;
+            for (int y = 0; y < outputSize.height; ++y) {
+                for (int x = 0; x < outputSize.width; ++x) {
+                    const Scalar* window = plane + y * pool_dim * convSize.width + x * pool_dim;
+                    int best = 0;
+                    Scalar max = window[0];
+                    for (int i = 0; i < pool_dim; ++i) {
+                        for (int j = 0; j < pool_dim; ++j) {
+                            if (window[i * convSize.width + j] > max) {
+                                max = window[i * convSize.width + j];
+                                best = i * pool_dim + j;
+                            }
+                        }
+                    }
+                    *pooled++ = max;
+                    *index++ = best;
                 }
             }
         }
     }
 }
 
-Maxpool2d::Maxpool2d(Tensor::Size inputSize, int kernel_dim)
+void ConvPool2d::backProp(const TensorView& dL_dA)
 {
+    assert(dL_dA.depth() == kernel_num && dL_dA.batch() == out.batch());
+    const int batch = out.batch();
+    const int area = convSize.height * convSize.width;
+
+    // only the window maxima reached the output; the activation there is the pooled value
+    Scalar* dL_dZ = workspace->allocate(batch * kernel_num * area);
+    std::fill(dL_dZ, dL_dZ + batch * kernel_num * area, Scalar(0));
+    Scalar* pooled = workspace->allocate(out.getRawSize());
+    activationBackward(out.getRawSize(), dL_dA.data(), out.data(), pooled);
+    int i = 0;
+    for (int n = 0; n < batch; ++n) {
+        for (int k = 0; k < kernel_num; ++k) {
+            Scalar* plane = dL_dZ + (n * kernel_num + k) * area;
+            for (int y = 0; y < outputSize.height; ++y) {
+                for (int x = 0; x < outputSize.width; ++x, ++i) {
+                    const int best = argmax[i];
+                    const int row = y * pool_dim + best / pool_dim;
+                    const int column = x * pool_dim + best % pool_dim;
+                    plane[row * convSize.width + column] = pooled[i];
+                }
+            }
+        }
+    }
+    backPropConv(dL_dZ, batch);
+}
 
+Maxpool2d::Maxpool2d(Tensor::Size inputSize, int kernel_dim, int stride)
+{
     this->kernel_dim = kernel_dim;
-    this->kernel_stride = kernel_dim;
+    this->kernel_stride = stride > 0 ? stride : kernel_dim;
+    assert(kernel_stride >= kernel_dim && kernel_dim * kernel_dim <= 256);
     this->kernel_padding = 0;
     this->kernel_num = inputSize.depth;
 
@@ -138,51 +401,236 @@ Maxpool2d::Maxpool2d(Tensor::Size inputSize, int kernel_dim)
     outputSize.width = (inputSize.width - kernel_dim) / kernel_stride + 1;
 
     dL_dX = Tensor(inputSize);
-    X = Tensor(inputSize);
-    mask = Tensor(inputSize);
     out = Tensor(outputSize);
 }
 
-void Maxpool2d::feedForward(const Layer2d& prevLayer)
+void Maxpool2d::feedForward(const TensorView& X)
 {
-    const auto& prevOut = prevLayer.getOut();
-    assert(out.depth() == prevOut.depth());
-    X = prevOut;
-
-    for (int c = 0; c < inputSize.depth; ++c) {
-        for (int y = 0; y < inputSize.height; y += kernel_dim) {
-            for (int x = 0; x < inputSize.width; x += kernel_dim) {
-                int yMax = y;
-                int xMax = x;
-                double max = X(y, x, c);
+    assert(out.depth() == X.depth());
 
-                for (int i = y; i < y + kernel_dim; ++i) {
-                    for (int j = x; j < x + kernel_dim; ++j) {
-                        double val = X(i, j, c);
-                        mask(i, j, c) = 0;
+    const int batch = X.batch();
+    out.setBatch(batch);
+    argmax.resize(out.getRawSize());
 
-                        if (val > max) {
-                            yMax = i;
-                            xMax = j;
-                            max = val;
+    Scalar* pooled = out.data();
+    uint8_t* index = argmax.data();
+    for (int n = 0; n < batch; ++n) {
+        for (int c = 0; c < inputSize.depth; ++c) {
+            for (int y = 0; y < outputSize.height; ++y) {
+                for (int x = 0; x < outputSize.width; ++x) {
+                    const int y0 = y * kernel_stride;
+                    const int x0 = x * kernel_stride;
+                    int best = 0;
+                    Scalar max = X(y0, x0, c, n);
+
+                    for (int i = 0; i < kernel_dim; ++i) {
+                        for (int j = 0; j < kernel_dim; ++j) {
+                            const Scalar val = X(y0 + i, x0 + j, c, n);
+                            if (val > max) {
+                                best = i * kernel_dim + j;
+                                max = val;
+                            }
                         }
                     }
+                    *pooled++ = max;
+                    *index++ = best;
                 }
-                out(y / kernel_dim, x / kernel_dim, c) = max;
-                mask(yMax, xMax, c) = 1;
             }
         }
     }
+}
 
+void Maxpool2d::backProp(const TensorView& dL_dA)
+{
+    const int batch = dL_dA.batch();
+    assert(batch == out.batch());
+    dL_dX.setBatch(batch);
+
+    // windows do not overlap, so every input position gets at most one gradient
+    std::fill(dL_dX.data(), dL_dX.data() + dL_dX.getRawSize(), Scalar(0));
+    const uint8_t* index = argmax.data();
+    for (int n = 0; n < batch; ++n) {
+        for (int c = 0; c < kernel_num; ++c) {
+            for (int y = 0; y < outputSize.height; ++y) {
+                for (int x = 0; x < outputSize.width; ++x) {
+                    const int best = *index++;
+                    dL_dX(y * kernel_stride + best / kernel_dim, x * kernel_stride + best % kernel_dim, c, n) = dL_dA(y, x, c, n);
+                }
+            }
+        }
+    }
 }
 
-void Maxpool2d::backProp(const Tensor& dL_dA, double alpha)
+bool Conv2dSelfTest(std::ostream& log)
 {
-    for (int c = 0; c < kernel_num; ++c) {
-        for (int i = 0; i < inputSize.height; ++i) {
-            for (int j = 0; j < inputSize.width; ++j) {
-                dL_dX(i, j, c) = dL_dA(i / kernel_dim, j / kernel_dim, c) * mask(i, j, c);
+    // the GEMMs sum in another order than the direct loops
+    const double tolerance = std::numeric_limits<Scalar>::epsilon() * 1000;
+    std::mt19937 gen(11);
+
+    // kernel_dim, stride, padding; a stride past the kernel leaves inputs no window reads
+    const int cases[][3] = { { 3, 1, 0 }, { 3, 1, 1 }, { 5, 1, 2 }, { 3, 2, 1 }, { 5, 2, 0 }, { 2, 3, 0 } };
+    // odd sizes, several channels, and several samples for the gradients to accumulate over
+    const Tensor::Size size = { 11, 13, 2, 3 };
+    const int kernel_num = 4;
+    // reference first; im2col for both passes keeps the lowered batch, the last one lowers
+    // each sample again in the backward pass
+    const EConvAlgorithm algorithms[][2] = {
+        { EConvAlgorithm::Direct, EConvAlgorithm::Direct },
+        { EConvAlgorithm::Im2col, EConvAlgorithm::Im2col },
+        { EConvAlgorithm::Direct, EConvAlgorithm::Im2col },
+    };
+    const int variants = sizeof(algorithms) / sizeof(algorithms[0]);
+
+    bool allPassed = true;
+    for (const auto& c : cases) {
+        const int kernel_dim = c[0];
+        const int stride = c[1];
+        const int padding = c[2];
+        std::vector<Conv2d> layers;
+        for (const auto& pair : algorithms) {
+            layers.emplace_back(size, EActivation::SIGMOID, kernel_num, stride, padding, kernel_dim);
+            layers.back().setAlgorithms(pair[0], pair[1]);
+        }
+        const int paramCount = layers[0].getParamCount();
+        Mat params = RandomValues(paramCount, gen);
+        const Mat input = RandomValues(size.height * size.width * size.depth * size.batch, gen);
+        Tensor::Size outSize = layers[0].getOutputSize();
+        outSize.batch = size.batch;
+        const Mat dL_dA = RandomValues(outSize.height * outSize.width * outSize.depth * outSize.batch, gen);
+
+        // stale values in the gradients must be overwritten, not accumulated into
+        std::vector<Mat> grads(variants, Mat(paramCount, std::numeric_limits<Scalar>::quiet_NaN()));
+        std::vector<Workspace> workspaces(variants);
+        for (int v = 0; v < variants; ++v) {
+            layers[v].bindParams(params.data(), grads[v].data());
+            workspaces[v].reserve(layers[v].getWorkspaceSize(size.batch));
+            layers[v].bindWorkspace(&workspaces[v]);
+            layers[v].feedForward(TensorView(input.data(), size));
+            layers[v].backProp(TensorView(dL_dA.data(), outSize));
+        }
+
+        const Conv2d& reference = layers[0];
+        for (int v = 1; v < variants; ++v) {
+            const double forward = MaxError(layers[v].getOut().data(), reference.getOut().data(), reference.getOut().getRawSize());
+            const double weights = MaxError(grads[v].data(), grads[0].data(), paramCount);
+            const double inputs = MaxError(layers[v].getDlDx().data(), reference.getDlDx().data(), reference.getDlDx().getRawSize());
+            const bool passed = forward <= tolerance && weights <= tolerance && inputs <= tolerance;
+            log << "conv2d " << kernel_dim << "x" << kernel_dim << " stride " << stride << " padding " << padding
+                << ", " << ToString(algorithms[v][0]) << "/" << ToString(algorithms[v][1]) << ": max error forward " << forward
+                << ", dL_dK and dL_db " << weights << ", dL_dX " << inputs << (passed ? " ok" : " MISMATCH") << std::endl;
+            allPassed &= passed;
+        }
+    }
+    return allPassed;
+}
+
+bool ConvPool2dSelfTest(std::ostream& log)
+{
+    // both sides run the same convolution, only the pooling and its gradient routing differ
+    const double tolerance = std::numeric_limits<Scalar>::epsilon() * 10;
+    std::mt19937 gen(13);
+
+    // kernel_dim, padding, pool_dim; 3x3 pooling of the 11x13 maps leaves a partial window out
+    const int cases[][3] = { { 5, 0, 2 }, { 3, 1, 2 }, { 3, 1, 3 } };
+    const Tensor::Size size = { 11, 13, 2, 3 };
+    const int kernel_num = 4;
+    bool allPassed = true;
+    for (const auto& c : cases) {
+        const int kernel_dim = c[0];
+        const int padding = c[1];
+        const int pool_dim = c[2];
+        // ReLU, as the networks use it: pooling windows of zeros test the tie breaking
+        ConvPool2d fused(size, EActivation::ReLU, kernel_num, 1, padding, kernel_dim, pool_dim);
+        Conv2d conv(size, EActivation::ReLU, kernel_num, 1, padding, kernel_dim);
+        Maxpool2d pool(conv.getOutputSize(), pool_dim);
+
+        const int paramCount = conv.getParamCount();
+        Mat params = RandomValues(paramCount, gen);
+        const Mat input = RandomValues(size.height * size.width * size.depth * size.batch, gen);
+        Tensor::Size outSize = fused.getOutputSize();
+        outSize.batch = size.batch;
+        const Mat dL_dA = RandomValues(outSize.height * outSize.width * outSize.depth * outSize.batch, gen);
+
+        Mat fusedGrads(paramCount, std::numeric_limits<Scalar>::quiet_NaN());
+        Mat grads(paramCount, std::numeric_limits<Scalar>::quiet_NaN());
+        Workspace fusedWorkspace;
+        Workspace workspace;
+        fused.bindParams(params.data(), fusedGrads.data());
+        conv.bindParams(params.data(), grads.data());
+        fusedWorkspace.reserve(fused.getWorkspaceSize(size.batch));
+        workspace.reserve(conv.getWorkspaceSize(size.batch));
+        fused.bindWorkspace(&fusedWorkspace);
+        conv.bindWorkspace(&workspace);
+
+        fused.feedForward(TensorView(input.data(), size));
+        fused.backProp(TensorView(dL_dA.data(), outSize));
+        conv.feedForward(TensorView(input.data(), size));
+        pool.feedForward(conv.getOut());
+        pool.backProp(TensorView(dL_dA.data(), outSize));
+        conv.backProp(pool.getDlDx());
+
+        const double forward = MaxError(fused.getOut().data(), pool.getOut().data(), pool.getOut().getRawSize());
+        const double weights = MaxError(fusedGrads.data(), grads.data(), paramCount);
+        const double inputs = MaxError(fused.getDlDx().data(), conv.getDlDx().data(), conv.getDlDx().getRawSize());
+        const bool passed = forward <= tolerance && weights <= tolerance && inputs <= tolerance;
+        log << "convpool2d " << kernel_dim << "x" << kernel_dim << " padding " << padding << ", " << pool_dim << "x" << pool_dim
+            << " pool: max error forward " << forward << ", dL_dK and dL_db " << weights << ", dL_dX " << inputs
+            << (passed ? " ok" : " MISMATCH") << std::endl;
+        allPassed &= passed;
+    }
+    return allPassed;
+}
+
+bool Maxpool2dSelfTest(std::ostream& log)
+{
+    std::mt19937 gen(14);
+
+    // kernel_dim, stride; strides past the window skip inputs, 11x13 leaves partial windows out
+    const int cases[][2] = { { 2, 2 }, { 2, 3 }, { 3, 4 } };
+    const Tensor::Size size = { 11, 13, 2, 3 };
+    bool allPassed = true;
+    for (const auto& c : cases) {
+        const int kernel_dim = c[0];
+        const int stride = c[1];
+        Maxpool2d pool(size, kernel_dim, stride);
+        const Mat input = RandomValues(size.height * size.width * size.depth * size.batch, gen);
+        const TensorView X(input.data(), size);
+        Tensor::Size outSize = pool.getOutputSize();
+        outSize.batch = size.batch;
+        const Mat dL_dA = RandomValues(outSize.height * outSize.width * outSize.depth * outSize.batch, gen);
+        const TensorView dA(dL_dA.data(), outSize);
+        pool.feedForward(X);
+        pool.backProp(dA);
+
+        // brute force: the first largest value of every window, and the gradient lands there alone
+        bool forward = true;
+        Tensor dX(size);
+        for (int n = 0; n < size.batch; ++n) {
+            for (int d = 0; d < size.depth; ++d) {
+                for (int y = 0; y < outSize.height; ++y) {
+                    for (int x = 0; x < outSize.width; ++x) {
+                        int bestY = y * stride;
+                        int bestX = x * stride;
+                        for (int i = 0; i < kernel_dim; ++i) {
+                            for (int j = 0; j < kernel_dim; ++j) {
+                                if (X(y * stride + i, x * stride + j, d, n) > X(bestY, bestX, d, n)) {
+                                    bestY = y * stride + i;
+                                    bestX = x * stride + j;
+                                }
+                            }
+                        }
+                        forward &= pool.getOut()(y, x, d, n) == X(bestY, bestX, d, n);
+                        dX(bestY, bestX, d, n) = dA(y, x, d, n);
+                    }
+                }
             }
         }
+        const bool backward = std::equal(dX.data(), dX.data() + dX.getRawSize(), pool.getDlDx().data());
+
+        const bool passed = forward && backward;
+        log << "maxpool2d " << kernel_dim << "x" << kernel_dim << " stride " << stride << ": forward " << (forward ? "ok" : "MISMATCH")
+            << ", gradient routing " << (backward ? "ok" : "MISMATCH") << std::endl;
+        allPassed &= passed;
     }
+    return allPassed;
 }
@@ -1,7 +1,23 @@
 #pragma once
 #include "Tensor.h"
 #include "Math.h"
+#include "Workspace.h"
+#include "Winograd.h"
 #include <functional>
+#include <iosfwd>
+#include <memory>
+#include <cstdint>
+
+enum class EConvAlgorithm {
+    // loops straight over the kernel windows, no lowering
+    Direct,
+    // im2col lowering and one GEMM per sample
+    Im2col,
+    // Winograd minimal filtering, 3x3 and 5x5 kernels with stride 1, forward only
+    Winograd
+};
+
+const char* ToString(EConvAlgorithm algorithm);
 
 class Layer2d {
 public:
@@ -22,9 +38,28 @@ public:
         kernel_stride(kernel_stride),
         kernel_num(kernel_num),
         kernel_padding(padding) {}
+    virtual ~Layer2d() {}
+
+    // input is the previous layer's output or the network input, batch included
+    virtual void feedForward(const TensorView& input) = 0;
+    // Writes the parameter gradients of the last batch into the bound gradient storage
+    virtual void backProp(const TensorView& dL_dA) = 0;
+    // Copy with its own activation buffers; it stays bound to the same storage until rebound
+    virtual std::unique_ptr<Layer2d> clone() const = 0;
 
-    virtual void feedForward(const Layer2d& prevLayer) = 0;
-    virtual void backProp(const Tensor& dL_dA, double alpha) = 0;
+    // Parameters and gradients live in flat buffers owned by the Net, layers only point into
+    // them; grads is null for layers that only run forward passes
+    virtual int getParamCount() const { return 0; }
+    virtual void bindParams(Scalar*, Scalar*) {}
+    virtual void initParams() {}
+    // Called once the shared parameters were changed, so caches derived from them are rebuilt
+    virtual void onParamsUpdated() {}
+
+    // Scalars backProp carves out of the workspace for the given batch size
+    virtual int getWorkspaceSize(int) const { return 0; }
+    void bindWorkspace(Workspace* workspace) { this->workspace = workspace; }
+    // Multiply-adds of one sample's forward pass, for the profiler
+    virtual double getMacs() const { return 0; }
 
     int getKernelDim() const { return kernel_dim; }
     int getKernelStride() const { return kernel_stride; }
@@ -39,9 +74,9 @@ public:
 protected:
     Tensor::Size inputSize;
     Tensor::Size outputSize;
+    Workspace* workspace = nullptr;
 
     Tensor out;
-    Tensor X;
     Tensor dL_dX;
     int kernel_dim;
     int kernel_stride;
@@ -54,27 +89,99 @@ class Conv2d : public Layer2d
 {
 public:
     Conv2d(const Tensor::Size& inSize, EActivation activation_func, int kernel_num, int stride, int padding, int kernel_dim);
-    Conv2d() {}
-    virtual void feedForward(const Layer2d& prevLayer) override;
-    void setOutput(const Tensor& tensor);
-    void backProp(const Tensor& dL_dA, double alpha=0.05) override;
+    void feedForward(const TensorView& input) override;
+    void backProp(const TensorView& dL_dA) override;
+    std::unique_ptr<Layer2d> clone() const override { return std::make_unique<Conv2d>(*this); }
+
+    int getParamCount() const override;
+    void bindParams(Scalar* params, Scalar* grads) override;
+    void initParams() override;
+    int getWorkspaceSize(int batch) const override;
+    void onParamsUpdated() override { kernelsChanged = true; }
+    double getMacs() const override;
 
+    // The forward and backward pass pick their algorithm independently
+    bool supportsForward(EConvAlgorithm algorithm) const;
+    bool supportsBackward(EConvAlgorithm algorithm) const;
+    void setAlgorithms(EConvAlgorithm forward, EConvAlgorithm backward);
+    EConvAlgorithm getForwardAlgorithm() const { return forwardAlgorithm; }
+    EConvAlgorithm getBackwardAlgorithm() const { return backwardAlgorithm; }
+
+protected:
+    // Per-batch setup of the forward pass, then convolve() once per sample
+    void prepareForward(const TensorView& input);
+    // activation(conv(sample n) + bias) into output, kernel_num x conv height x conv width
+    void convolve(int n, Scalar* output);
+    // Parameter gradients and dL_dX from the gradient at the convolution output
+    void backPropConv(const Scalar* dL_dZ, int batch);
+    // dL_dK, dL_db and dL_dX of sample n without lowering; dL_dK and dL_db accumulate
+    void backPropDirect(int n, const Scalar* dL_dZ);
+    // the forward pass lowers the whole batch and the backward pass reuses it
+    bool keepsCol() const { return forwardAlgorithm == EConvAlgorithm::Im2col && backwardAlgorithm == EConvAlgorithm::Im2col; }
 
+    EConvAlgorithm forwardAlgorithm = EConvAlgorithm::Im2col;
+    EConvAlgorithm backwardAlgorithm = EConvAlgorithm::Im2col;
+    Winograd winograd;
+    // the Winograd kernel transform is stale
+    bool kernelsChanged = true;
+    // input of the last forward pass, the previous layer's output stays put until backProp
+    TensorView input;
+
+    // size of the convolution output, outputSize of the layers built on top may differ
+    Tensor::Size convSize;
+    // kernel_num x (depth * kernel_dim * kernel_dim) row-major matrix, one kernel per row
+    Scalar* kernels = nullptr;
+    Scalar* bias = nullptr;
+    Scalar* dL_dK = nullptr;
+    Scalar* dL_db = nullptr;
+    // im2col lowering of the input: (depth * kernel_dim * kernel_dim) x (out height * out width),
+    // for the whole batch when both passes use Im2col, one sample at a time otherwise
+    Mat col;
+    // Simd() kernels of the activation function, run over whole planes
+    void (*activation)(int n, Scalar* x) = nullptr;
+    void (*activationBackward)(int n, const Scalar* dA, const Scalar* out, Scalar* dZ) = nullptr;
+};
+
+// Conv2d followed by a non-overlapping max pooling, which the Net substitutes for that pair
+// of layers. Each sample's activated convolution output is computed into a buffer that stays
+// in cache and pooled straight away; only the pooled output and the argmax position inside
+// each window are kept, the full-size activation and mask tensors are never written.
+class ConvPool2d : public Conv2d
+{
+public:
+    ConvPool2d(const Tensor::Size& inSize, EActivation activation_func, int kernel_num, int stride, int padding, int kernel_dim, int pool_dim);
+    void feedForward(const TensorView& input) override;
+    void backProp(const TensorView& dL_dA) override;
+    std::unique_ptr<Layer2d> clone() const override { return std::make_unique<ConvPool2d>(*this); }
+    int getWorkspaceSize(int batch) const override;
+
+    int getPoolDim() const { return pool_dim; }
 private:
-    std::vector<Tensor> kernels;
-    std::vector<double> bias;
-    std::vector<Tensor> dL_dK;
-    std::vector<double> dL_db;
-    std::function<double(double)> activation;
-    std::function<double(double)> derivActivation;
+    int pool_dim;
+    // activated convolution output of the sample being pooled
+    Mat conv;
+    // row * pool_dim + column of the maximum inside each pooling window, per output element
+    std::vector<uint8_t> argmax;
 };
 
 class Maxpool2d : public Layer2d
 {
 public:
-    Maxpool2d(Tensor::Size inputSize, int kernel_dim);
-    void feedForward(const Layer2d& prevLayer) override;
-    void backProp(const Tensor& dL_dA, double alpha) override;
+    // non-overlapping windows: stride defaults to the window size and may not be smaller
+    Maxpool2d(Tensor::Size inputSize, int kernel_dim, int stride = 0);
+    void feedForward(const TensorView& input) override;
+    void backProp(const TensorView& dL_dA) override;
+    std::unique_ptr<Layer2d> clone() const override { return std::make_unique<Maxpool2d>(*this); }
 private:
-    Tensor mask;
+    // row * kernel_dim + column of the maximum inside each window, per output element
+    std::vector<uint8_t> argmax;
 };
+
+// Checks the im2col + GEMM forward and backward passes against the direct loops over
+// strides and paddings, logs the error per case
+bool Conv2dSelfTest(std::ostream& log);
+// Checks the fused layer's output and gradients against Conv2d followed by Maxpool2d
+bool ConvPool2dSelfTest(std::ostream& log);
+// Checks Maxpool2d's maxima and gradient routing against brute force, strides wider than
+// the window included
+bool Maxpool2dSelfTest(std::ostream& log);
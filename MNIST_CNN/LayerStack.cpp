@@ -0,0 +1,253 @@
+#include "LayerStack.h"
+#include "ConvTuner.h"
+#include "MNIST.h"
+#include <cassert>
+
+namespace {
+    // Rounds a layer's parameter count up to whole cache lines, so the next layer's
+    // weights start 64-byte aligned inside the flat buffer
+    int AlignedParamCount(int count)
+    {
+        const int line = 64 / sizeof(Scalar);
+        return (count + line - 1) / line * line;
+    }
+
+#ifdef MNIST_CNN_PROFILE
+    double Elements(const Tensor::Size& size)
+    {
+        return double(size.height) * size.width * size.depth;
+    }
+
+    // A pass reads its input and parameters and writes its output; the backward pass
+    // does about twice the work of the forward one, reading the saved activations too
+    double ForwardFlops(const Layer2d& layer, int batch)
+    {
+        return 2 * layer.getMacs() * batch;
+    }
+
+    double ForwardBytes(const Layer2d& layer, int batch)
+    {
+        return ((Elements(layer.getInputSize()) + Elements(layer.getOutputSize())) * batch + layer.getParamCount()) * sizeof(Scalar);
+    }
+
+    double ForwardFlops(const Layer& layer, int batch)
+    {
+        return 2.0 * layer.getInputSize() * layer.getOutputSize() * batch;
+    }
+
+    double ForwardBytes(const Layer& layer, int batch)
+    {
+        return ((double(layer.getInputSize()) + layer.getOutputSize()) * batch + layer.getParamCount()) * sizeof(Scalar);
+    }
+
+    const char* ScopeName(const std::string& layer, int index, const char* pass)
+    {
+        return Profiler::Intern(layer + "#" + std::to_string(index) + "." + pass);
+    }
+#endif
+}
+
+LayerStack::LayerStack(const std::vector<Layer2d::Topology>& topology2d, const std::vector<Layer::Topology>& topology)
+{
+    for (int i = 0; i < int(topology2d.size()); ++i) {
+        const auto& t = topology2d[i];
+        if (t.layer_name == "Conv2d") {
+            Conv2d conv(t.input_size, t.activation_func, t.kernel_num, t.kernel_stride, t.padding, t.kernel_dim);
+            const Tensor::Size convOut = conv.getOutputSize();
+
+            // a max pooling straight on the convolution output runs fused into it
+            const Layer2d::Topology* pool = (i + 1 < int(topology2d.size())) ? &topology2d[i + 1] : nullptr;
+            if (pool && pool->layer_name == "Maxpool" && (pool->kernel_stride == 0 || pool->kernel_stride == pool->kernel_dim)
+                && pool->input_size.height == convOut.height
+                && pool->input_size.width == convOut.width && pool->input_size.depth == convOut.depth) {
+                layers2d.push_back(std::make_unique<ConvPool2d>(t.input_size, t.activation_func, t.kernel_num, t.kernel_stride, t.padding, t.kernel_dim, pool->kernel_dim));
+                ++i;
+            }
+            else {
+                layers2d.push_back(std::make_unique<Conv2d>(conv));
+            }
+        }
+        else if (t.layer_name == "Maxpool") {
+            layers2d.push_back(std::make_unique<Maxpool2d>(Maxpool2d(t.input_size, t.kernel_dim, t.kernel_stride)));
+        }
+    }
+
+    for (const auto& t : topology) {
+        if (t.layer_name == "Dense") {
+            layers.push_back(std::make_unique<DenseLayer>(DenseLayer(t.input_size, t.output_size, t.activation_func)));
+        }
+        else if (t.layer_name == "Softmax") {
+            layers.push_back(std::make_unique<SoftmaxLayer>(SoftmaxLayer(t.input_size, t.output_size)));
+        }
+    }
+    assert(!layers.empty());
+
+#ifdef MNIST_CNN_PROFILE
+    for (int i = 0; i < int(layers2d.size()); ++i) {
+        const Layer2d* layer = layers2d[i].get();
+        const char* type = dynamic_cast<const ConvPool2d*>(layer) ? "ConvPool2d"
+            : dynamic_cast<const Conv2d*>(layer) ? "Conv2d" : "Maxpool2d";
+        forwardNames2d.push_back(ScopeName(type, i, "forward"));
+        backwardNames2d.push_back(ScopeName(type, i, "backward"));
+    }
+    for (int i = 0; i < int(layers.size()); ++i) {
+        const char* type = dynamic_cast<const SoftmaxLayer*>(layers[i].get()) ? "Softmax" : "Dense";
+        forwardNames.push_back(ScopeName(type, i, "forward"));
+        backwardNames.push_back(ScopeName(type, i, "backward"));
+    }
+#endif
+}
+
+LayerStack LayerStack::clone() const
+{
+    LayerStack copy;
+    for (const auto& layer : layers2d) {
+        copy.layers2d.push_back(layer->clone());
+    }
+    for (const auto& layer : layers) {
+        copy.layers.push_back(layer->clone());
+    }
+#ifdef MNIST_CNN_PROFILE
+    copy.forwardNames2d = forwardNames2d;
+    copy.backwardNames2d = backwardNames2d;
+    copy.forwardNames = forwardNames;
+    copy.backwardNames = backwardNames;
+#endif
+    return copy;
+}
+
+int LayerStack::getParamCount() const
+{
+    int count = 0;
+    for (const auto& layer : layers2d) {
+        count += AlignedParamCount(layer->getParamCount());
+    }
+    for (const auto& layer : layers) {
+        count += AlignedParamCount(layer->getParamCount());
+    }
+    return count;
+}
+
+void LayerStack::bind(Scalar* params, Scalar* grads, Workspace* workspace)
+{
+    Scalar* p = params;
+    Scalar* g = grads;
+    for (const auto& layer : layers2d) {
+        layer->bindParams(p, g);
+        layer->bindWorkspace(workspace);
+        p += AlignedParamCount(layer->getParamCount());
+        g = g ? g + AlignedParamCount(layer->getParamCount()) : nullptr;
+    }
+    for (const auto& layer : layers) {
+        layer->bindParams(p, g);
+        layer->bindWorkspace(workspace);
+        p += AlignedParamCount(layer->getParamCount());
+        g = g ? g + AlignedParamCount(layer->getParamCount()) : nullptr;
+    }
+}
+
+void LayerStack::initParams()
+{
+    for (const auto& layer : layers2d) {
+        layer->initParams();
+    }
+    for (const auto& layer : layers) {
+        layer->initParams();
+    }
+}
+
+void LayerStack::onParamsUpdated()
+{
+    for (const auto& layer : layers2d) {
+        layer->onParamsUpdated();
+    }
+}
+
+void LayerStack::tuneConvolutions(bool training)
+{
+    ConvTuner tuner;
+    for (const auto& layer : layers2d) {
+        if (Conv2d* conv = dynamic_cast<Conv2d*>(layer.get())) {
+            const ConvTuner::Choice choice = tuner.tune(*conv, training);
+            conv->setAlgorithms(choice.forward, choice.backward);
+        }
+    }
+    if (training) {
+        tuner.save();
+    }
+}
+
+int LayerStack::getWorkspaceSize(int batch) const
+{
+    int size = 0;
+    for (const auto& layer : layers2d) {
+        size += layer->getWorkspaceSize(batch);
+    }
+    for (const auto& layer : layers) {
+        size += layer->getWorkspaceSize(batch);
+    }
+    return size;
+}
+
+Tensor::Size LayerStack::getInputSize() const
+{
+    return layers2d.empty() ? Tensor::Size{ MNIST::IMG_HEIGHT, MNIST::IMG_WIDTH, 1 } : layers2d[0]->getInputSize();
+}
+
+const Mat& LayerStack::forward(const TensorView& input)
+{
+    PROFILE_SCOPE("Net.forward");
+    // only read by the profiler scopes
+    [[maybe_unused]] const int batch = input.batch();
+    if (!layers2d.empty()) {
+        {
+            PROFILE_SCOPE(forwardNames2d[0], ForwardFlops(*layers2d[0], batch), ForwardBytes(*layers2d[0], batch));
+            layers2d[0]->feedForward(input);
+        }
+        for (int i = 1; i < int(layers2d.size()); ++i) {
+            PROFILE_SCOPE(forwardNames2d[i], ForwardFlops(*layers2d[i], batch), ForwardBytes(*layers2d[i], batch));
+            layers2d[i]->feedForward(layers2d[i - 1]->getOut());
+        }
+    }
+
+    // NCHW samples are already flat, the first dense layer reads them in place, in backprop too
+    const TensorView flat = layers2d.empty() ? input : TensorView(layers2d.back()->getOut());
+    {
+        PROFILE_SCOPE(forwardNames[0], ForwardFlops(*layers[0], batch), ForwardBytes(*layers[0], batch));
+        layers[0]->feedForward(flat.data(), flat.batch());
+    }
+    for (int i = 1; i < int(layers.size()); ++i) {
+        PROFILE_SCOPE(forwardNames[i], ForwardFlops(*layers[i], batch), ForwardBytes(*layers[i], batch));
+        layers[i]->feedForward(layers[i - 1]->getOut());
+    }
+
+    return layers.back()->getOut();
+}
+
+void LayerStack::backprop(const Mat& y)
+{
+    PROFILE_SCOPE("Net.backprop");
+    const int batch = layers[0]->getBatch();
+    {
+        PROFILE_SCOPE(backwardNames.back(), 2 * ForwardFlops(*layers.back(), batch), 2 * ForwardBytes(*layers.back(), batch));
+        layers.back()->backProp(y);
+    }
+    for (int i = layers.size() - 2; i >= 0; --i) {
+        PROFILE_SCOPE(backwardNames[i], 2 * ForwardFlops(*layers[i], batch), 2 * ForwardBytes(*layers[i], batch));
+        layers[i]->backProp(layers[i + 1]->getDlDx());
+    }
+
+    if (!layers2d.empty()) {
+        Tensor::Size size = layers2d.back()->getOutputSize();
+        size.batch = batch;
+        {
+            PROFILE_SCOPE(backwardNames2d.back(), 2 * ForwardFlops(*layers2d.back(), batch), 2 * ForwardBytes(*layers2d.back(), batch));
+            // the first dense layer's dL_dX is already in NCHW order, read it in place
+            layers2d.back()->backProp(TensorView(layers[0]->getDlDx().data(), size));
+        }
+        for (int i = layers2d.size() - 2; i >= 0; --i) {
+            PROFILE_SCOPE(backwardNames2d[i], 2 * ForwardFlops(*layers2d[i], batch), 2 * ForwardBytes(*layers2d[i], batch));
+            layers2d[i]->backProp(layers2d[i + 1]->getDlDx());
+        }
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include "Layer.h"
+#include "Layer2d.h"
+#include "Profiler.h"
+#include <memory>
+#include <vector>
+
+// The layers of a network in order, built from its topology. Layers only point at the
+// parameters, so the clones of a stack share one set of weights and each keeps its own
+// activations, gradients and caches.
+class LayerStack
+{
+public:
+    LayerStack() {}
+    // A max pooling straight on a convolution output is fused into a ConvPool2d
+    LayerStack(const std::vector<Layer2d::Topology>& topology2d, const std::vector<Layer::Topology>& topology);
+    LayerStack(LayerStack&&) = default;
+    LayerStack& operator=(LayerStack&&) = default;
+    // Copy bound to the same storage until rebound
+    LayerStack clone() const;
+
+    // Scalars of the flat parameter buffer; every layer's slice starts on a cache line
+    int getParamCount() const;
+    // grads and workspace may be null for a stack that only runs forward passes
+    void bind(Scalar* params, Scalar* grads, Workspace* workspace);
+    void initParams();
+    void onParamsUpdated();
+    // Every convolution runs the algorithms that are fastest for its shape on this machine.
+    // A stack that only predicts tunes the forward pass and leaves the tuning file to
+    // training runs.
+    void tuneConvolutions(bool training);
+    int getWorkspaceSize(int batch) const;
+
+    // Scores of every sample in input, one row of getClasses() per sample
+    const Mat& forward(const TensorView& input);
+    // Parameter gradients of the last forward pass against the expected scores y
+    void backprop(const Mat& y);
+    const Mat& getOut() const { return layers.back()->getOut(); }
+
+    Tensor::Size getInputSize() const;
+    int getClasses() const { return layers.back()->getOutputSize(); }
+private:
+    std::vector<std::unique_ptr<Layer2d>> layers2d;
+    std::vector<std::unique_ptr<Layer>> layers;
+#ifdef MNIST_CNN_PROFILE
+    // profiler scope per layer and pass, e.g. "ConvPool2d#0.forward"
+    std::vector<const char*> forwardNames2d;
+    std::vector<const char*> backwardNames2d;
+    std::vector<const char*> forwardNames;
+    std::vector<const char*> backwardNames;
+#endif
+};
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+// Memory mapping of a whole file. Read-only by default; a copy-on-write mapping can be
+// written through, the changes stay private to the process and never reach the file.
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string& path, bool copyOnWrite = false);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    void operator=(const MappedFile&) = delete;
+
+    const uint8_t* data() const { return base; }
+    // only for copy-on-write mappings
+    uint8_t* data() { return base; }
+    size_t size() const { return length; }
+private:
+    void unmap();
+private:
+    uint8_t* base = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#endif
+};
@@ -1,68 +1,128 @@
 #include "Math.h"
 #include <cassert>
 #include <random>
+#include <algorithm>
 
-Tensor Conv(const Tensor& img, const Tensor& kernel, int stride, int padding)
+Tensor Conv(const TensorView& img, const TensorView& kernel, int stride, int padding)
 {
-    assert(img.depth() == kernel.depth());
-
     Tensor::Size outSize;
     outSize.width = (img.width() + 2 * padding - kernel.width()) / stride + 1;
     outSize.height = (img.height() + 2 * padding - kernel.height()) / stride + 1;
     outSize.depth = 1;
     Tensor out(outSize);
+    Conv(img, kernel, stride, padding, out.data());
+    return out;
+}
 
-    for (int y = 0; y < outSize.height; ++y) {
-        for (int x = 0; x < outSize.width; ++x) {
-            double sum = 0;
+void Conv(const TensorView& img, const TensorView& kernel, int stride, int padding, Scalar* out)
+{
+    assert(img.depth() == kernel.depth());
 
-            for (int i = 0; i < kernel.height(); ++i) {
-                for (int j = 0; j < kernel.width(); ++j) {
-                    int i0 = stride * y + i - padding;
-                    int j0 = stride * x + j - padding;
+    const int outHeight = (img.height() + 2 * padding - kernel.height()) / stride + 1;
+    const int outWidth = (img.width() + 2 * padding - kernel.width()) / stride + 1;
+    std::fill(out, out + outHeight * outWidth, Scalar(0));
+
+    // one kernel weight at a time over the whole output, so the inner loop runs along an image row
+    for (int c = 0; c < img.depth(); ++c) {
+        for (int i = 0; i < kernel.height(); ++i) {
+            for (int j = 0; j < kernel.width(); ++j) {
+                const Scalar w = kernel(i, j, c);
+                // outputs whose input column stays inside the image
+                const int xBegin = std::max(0, (padding - j + stride - 1) / stride);
+                const int xEnd = std::min(outWidth, (img.width() + padding - j + stride - 1) / stride);
+
+                for (int y = 0; y < outHeight; ++y) {
+                    const int i0 = stride * y + i - padding;
+                    if (i0 < 0 || i0 >= img.height()) {
+                        continue;
+                    }
+                    Scalar* row = out + y * outWidth;
+                    for (int x = xBegin; x < xEnd; ++x) {
+                        row[x] += w * img(i0, stride * x + j - padding, c);
+                    }
+                }
+            }
+        }
+    }
+}
 
-                    if (i0 < 0 || i0 >= img.height() || j0 < 0 || j0 >= img.width()) {
+void Im2col(const Scalar* img, const Tensor::Size& size, int kernel_dim, int stride, int padding, Scalar* col)
+{
+    const int outHeight = (size.height + 2 * padding - kernel_dim) / stride + 1;
+    const int outWidth = (size.width + 2 * padding - kernel_dim) / stride + 1;
+
+    for (int c = 0; c < size.depth; ++c) {
+        const Scalar* channel = img + c * size.height * size.width;
+        for (int i = 0; i < kernel_dim; ++i) {
+            for (int j = 0; j < kernel_dim; ++j) {
+                for (int y = 0; y < outHeight; ++y) {
+                    const int i0 = stride * y + i - padding;
+                    if (i0 < 0 || i0 >= size.height) {
+                        std::fill(col, col + outWidth, Scalar(0));
+                        col += outWidth;
                         continue;
                     }
 
-                    for (int c = 0; c < img.depth(); ++c) {
-                        sum += kernel(i, j, c) * img(i0, j0, c);
+                    const Scalar* row = channel + i0 * size.width;
+                    for (int x = 0; x < outWidth; ++x) {
+                        const int j0 = stride * x + j - padding;
+                        *col++ = (j0 < 0 || j0 >= size.width) ? 0 : row[j0];
                     }
                 }
             }
-            out(y, x, 0) = sum;
         }
     }
-
-    return out;
 }
 
-Mat Flatten(const Tensor& tensor)
+void Col2im(const Scalar* col, const Tensor::Size& size, int kernel_dim, int stride, int padding, Scalar* img)
 {
-    Mat flatted;
-    for (int d = 0; d < tensor.depth(); ++d) {
-        for (int i = 0; i < tensor.height(); ++i) {
-            for (int j = 0; j < tensor.width(); ++j) {
-                flatted.push_back(tensor(i, j, d));
+    const int outHeight = (size.height + 2 * padding - kernel_dim) / stride + 1;
+    const int outWidth = (size.width + 2 * padding - kernel_dim) / stride + 1;
+
+    std::fill(img, img + size.depth * size.height * size.width, Scalar(0));
+    for (int c = 0; c < size.depth; ++c) {
+        Scalar* channel = img + c * size.height * size.width;
+        for (int i = 0; i < kernel_dim; ++i) {
+            for (int j = 0; j < kernel_dim; ++j) {
+                for (int y = 0; y < outHeight; ++y) {
+                    const int i0 = stride * y + i - padding;
+                    if (i0 < 0 || i0 >= size.height) {
+                        col += outWidth;
+                        continue;
+                    }
+
+                    Scalar* row = channel + i0 * size.width;
+                    for (int x = 0; x < outWidth; ++x, ++col) {
+                        const int j0 = stride * x + j - padding;
+                        if (j0 >= 0 && j0 < size.width) {
+                            row[j0] += *col;
+                        }
+                    }
+                }
             }
         }
     }
-    return flatted;
 }
 
-double Sigmoid(double x) {
-    return 1 / (1 + exp(-x));
+Mat Flatten(const Tensor& tensor)
+{
+    // NCHW storage already holds each sample's channels, rows and columns in flattened order
+    return Mat(tensor.data(), tensor.data() + tensor.getRawSize());
 }
 
-double SigmoidDeriv(double x) {
+Scalar Sigmoid(Scalar x) {
+    return 1 / (1 + std::exp(-x));
+}
+
+Scalar SigmoidDeriv(Scalar x) {
     return Sigmoid(x) * (1 - Sigmoid(x));
 }
 
-double ReLU(double x) {
+Scalar ReLU(Scalar x) {
     return x > 0 ? x : 0;
 }
 
-double ReluDeriv(double x) {
+Scalar ReluDeriv(Scalar x) {
     return x > 0 ? 1 : 0;
 }
 
@@ -83,8 +143,12 @@ double NRand(double mean, double stddev)
 
 int ArgMax(const Mat& arr) {
     assert(!arr.empty());
+    return ArgMax(arr.data(), arr.size());
+}
+
+int ArgMax(const Scalar* arr, int size) {
     int iMax = 0;
-    for (int i = 0; i < arr.size(); ++i) {
+    for (int i = 0; i < size; ++i) {
         if (arr[i] > arr[iMax]) {
             iMax = i;
         }
@@ -102,7 +166,7 @@ Mat operator+(const Mat& m1, const Mat& m2)
     return res;
 }
 
-Mat2 operator+(const Mat2& m2, double n)
+Mat2 operator+(const Mat2& m2, Scalar n)
 {
     Mat2 res(m2);
     for (int i = 0; i < m2.size(); ++i) {
@@ -3,9 +3,9 @@
 #include <cmath>
 #include "Tensor.h"
 
-typedef std::vector<double> Mat;
-typedef std::vector<std::vector<double>> Mat2;
-typedef std::vector<std::vector<std::vector<double>>> Mat3;
+typedef std::vector<Scalar> Mat;
+typedef std::vector<std::vector<Scalar>> Mat2;
+typedef std::vector<std::vector<std::vector<Scalar>>> Mat3;
 
 enum class EActivation {
     ReLU,
@@ -15,15 +15,20 @@ enum class EActivation {
 std::ostream& operator<<(std::ostream& out, const Mat& mat);
 std::ostream& operator<<(std::ostream& out, const Mat2& mat);
 Mat operator+(const Mat& m1, const Mat& m2);
-Mat2 operator+(const Mat2& m2, double n);
+Mat2 operator+(const Mat2& m2, Scalar n);
 void operator+=(Mat2& m3, const Mat2& m2);
 
-Tensor Conv(const Tensor& img, const Tensor& kernel, int stride, int padding);
+Tensor Conv(const TensorView& img, const TensorView& kernel, int stride, int padding);
+// Same, into a caller-owned out height x out width buffer
+void Conv(const TensorView& img, const TensorView& kernel, int stride, int padding, Scalar* out);
+void Im2col(const Scalar* img, const Tensor::Size& size, int kernel_dim, int stride, int padding, Scalar* col);
+void Col2im(const Scalar* col, const Tensor::Size& size, int kernel_dim, int stride, int padding, Scalar* img);
 Mat Flatten(const Tensor& tensor);
-double Sigmoid(double x);
-double SigmoidDeriv(double x);
-double ReLU(double x);
-double ReluDeriv(double x);
+Scalar Sigmoid(Scalar x);
+Scalar SigmoidDeriv(Scalar x);
+Scalar ReLU(Scalar x);
+Scalar ReluDeriv(Scalar x);
 double Rand(int minus = false);
 double NRand(double mean, double stddev);
 int ArgMax(const Mat& arr);
+int ArgMax(const Scalar* arr, int size);
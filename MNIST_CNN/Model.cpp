@@ -0,0 +1,40 @@
+#include "Model.h"
+#include <stdexcept>
+
+Model::Model(const std::vector<Layer2d::Topology>& topology2d, const std::vector<Layer::Topology>& topology,
+    const Scalar* params, int paramCount) :
+    ownedParams(params, params + paramCount),
+    prototype(topology2d, topology)
+{
+    if (prototype.getParamCount() != paramCount) {
+        throw std::invalid_argument("the parameters do not match the topology");
+    }
+    prototype.bind(ownedParams.data(), nullptr, nullptr);
+    prototype.tuneConvolutions(false);
+}
+
+Model::Model(const std::string& path) :
+    checkpoint(std::make_unique<Checkpoint>(path))
+{
+    prototype = LayerStack(checkpoint->getTopology2d(), checkpoint->getTopology());
+    if (prototype.getParamCount() != checkpoint->getParamCount()) {
+        throw std::runtime_error(path + " does not hold the parameters of its topology");
+    }
+    prototype.bind(checkpoint->getParams(), nullptr, nullptr);
+    prototype.tuneConvolutions(false);
+}
+
+InferenceContext Model::createContext(int batch) const
+{
+    InferenceContext context(prototype.clone());
+    // one pass over zeros brings every activation buffer to its size
+    Tensor::Size size = getInputSize();
+    size.batch = batch;
+    context.layers.forward(Tensor(size));
+    return context;
+}
+
+const Mat& Model::predict(const TensorView& input, InferenceContext& context) const
+{
+    return context.layers.forward(input);
+}
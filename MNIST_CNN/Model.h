@@ -0,0 +1,47 @@
+#pragma once
+#include "LayerStack.h"
+#include "Checkpoint.h"
+#include <memory>
+
+// Activations of one forward pass at a time through a Model or a Net. Keep one per
+// thread: the buffers keep their size from call to call.
+class InferenceContext
+{
+public:
+    InferenceContext(InferenceContext&&) = default;
+    InferenceContext& operator=(InferenceContext&&) = default;
+private:
+    friend class Model;
+    friend class Net;
+    explicit InferenceContext(LayerStack layers) : layers(std::move(layers)) {}
+private:
+    LayerStack layers;
+};
+
+// A trained network for serving: the topology and one copy of the parameters, never
+// written after construction. Any number of threads can predict through it at once,
+// each with its own InferenceContext.
+class Model
+{
+public:
+    // Copies the parameters
+    Model(const std::vector<Layer2d::Topology>& topology2d, const std::vector<Layer::Topology>& topology,
+        const Scalar* params, int paramCount);
+    // Maps the parameters of a checkpoint written by Net::save
+    explicit Model(const std::string& path);
+    Model(const Model&) = delete;
+    void operator=(const Model&) = delete;
+
+    // Buffers sized for batches of up to `batch` samples
+    InferenceContext createContext(int batch = 1) const;
+    // Scores of every sample in input, one row per sample, valid until the context's next call
+    const Mat& predict(const TensorView& input, InferenceContext& context) const;
+
+    Tensor::Size getInputSize() const { return prototype.getInputSize(); }
+    int getClasses() const { return prototype.getClasses(); }
+private:
+    AlignedMat ownedParams;
+    std::unique_ptr<Checkpoint> checkpoint;
+    // bound to the parameters, every context is a clone of it
+    LayerStack prototype;
+};
@@ -1,5 +1,12 @@
 #include "Net.h"
+#include "Simd.h"
+#include "AllocationCounter.h"
+#include "Profiler.h"
 #include <cassert>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
 
 namespace {
     void ShowImg(const Mat2& num) {
@@ -17,108 +24,383 @@ namespace {
     }
 }
 
-Net::Net(const std::vector<Layer2d::Topology>& topology2d, const std::vector<Layer::Topology>& topology)
+Net::Net(const std::vector<Layer2d::Topology>& topology2d, const std::vector<Layer::Topology>& topology) :
+    topology2d(topology2d),
+    topology(topology)
 {
-    for (const auto& t : topology2d) {
-        if (t.layer_name == "Conv2d") {
-            layers2d.push_back(std::make_unique<Conv2d>(Conv2d(t.input_size, t.activation_func, t.kernel_num, t.kernel_stride, t.padding, t.kernel_dim)));
-        }
-        else if (t.layer_name == "Maxpool") {
-            layers2d.push_back(std::make_unique<Maxpool2d>(Maxpool2d(t.input_size, t.kernel_dim)));
-        }
+    createLayers();
+    ownedParams.resize(paramCount);
+    params = ownedParams.data();
+    bindFirstReplica();
+    replicas[0].layers.initParams();
+    replicas[0].layers.tuneConvolutions(false);
+}
+
+Net::Net(const std::string& path) :
+    checkpoint(std::make_unique<Checkpoint>(path))
+{
+    topology2d = checkpoint->getTopology2d();
+    topology = checkpoint->getTopology();
+    createLayers();
+    if (checkpoint->getParamCount() != paramCount) {
+        throw std::runtime_error(path + " does not hold the parameters of its topology");
     }
+    params = checkpoint->getParams();
+    bindFirstReplica();
+    replicas[0].layers.tuneConvolutions(false);
+}
 
-    for (const auto& t : topology) {
-        if (t.layer_name == "Dense") {
-            layers.push_back(std::make_unique<DenseLayer>(DenseLayer(t.input_size, t.output_size, t.activation_func)));
-        }
-        else if (t.layer_name == "Softmax") {
-            layers.push_back(std::make_unique<SoftmaxLayer>(SoftmaxLayer(t.input_size, t.output_size)));
-        }
+void Net::save(const std::string& path, const TrainProgress& progress) const
+{
+    Checkpoint::save(path, topology2d, topology, params, paramCount, progress);
+}
+
+TrainProgress Net::getProgress() const
+{
+    return checkpoint ? checkpoint->getProgress() : TrainProgress();
+}
+
+void Net::checkpointEvery(const std::string& path, int interval)
+{
+    assert(interval > 0);
+    checkpointWriter = std::make_unique<CheckpointWriter>(path, topology2d, topology);
+    checkpointInterval = interval;
+    sinceCheckpoint = 0;
+}
+
+void Net::setInputThreads(int threads)
+{
+    assert(threads > 0);
+    inputThreads = threads;
+    pipeline.reset();
+}
+
+void Net::augment(const Augmenter::Options& options)
+{
+    augmentation = std::make_unique<Augmenter::Options>(options);
+    pipeline.reset();
+}
+
+void Net::createLayers()
+{
+    replicas.emplace_back();
+    replicas[0].layers = LayerStack(topology2d, topology);
+    inputSize = replicas[0].layers.getInputSize();
+    classes = replicas[0].layers.getClasses();
+    paramCount = replicas[0].layers.getParamCount();
+}
+
+void Net::bindFirstReplica()
+{
+    replicas[0].grads.resize(paramCount);
+    replicas[0].workspace = std::make_unique<Workspace>();
+    bind(replicas[0]);
+    reserveWorkspaces(1);
+}
+
+void Net::bind(Replica& replica)
+{
+    replica.layers.bind(params, replica.grads.data(), replica.workspace.get());
+}
+
+void Net::addReplicas(int count)
+{
+    while (int(replicas.size()) < count) {
+        Replica replica;
+        replica.layers = replicas[0].layers.clone();
+        replica.grads.resize(paramCount);
+        replica.workspace = std::make_unique<Workspace>();
+        bind(replica);
+        replicas.push_back(std::move(replica));
     }
 }
 
-void Net::train(const MNIST::LabeledSamples& train, double alpha)
+void Net::reserveWorkspaces(int batch)
 {
-    int corrects = 0;
-    for (int i = 0; i < train.size(); ++i) {
-        Mat out = forward(train[i].second);
+    for (auto& replica : replicas) {
+        replica.workspace->reserve(replica.layers.getWorkspaceSize(batch));
+    }
+}
 
-        corrects += (ArgMax(out) == ArgMax(train[i].first)) ? 1 : 0;
-        if (i % 100 == 0) {
-            std::cout << "#" << i << " " << double(corrects) / 100 << std::endl;
-            corrects = 0;
-        }
+void Net::usePool(int threads)
+{
+    if (!pool || pool->size() != threads) {
+        pool = std::make_unique<ThreadPool>(threads);
+    }
+}
 
-        backprop(train[i].first, alpha);
+void Net::usePipeline(int slots)
+{
+    if (!pipeline || pipeline->getSlotCount() < slots) {
+        pipeline = std::make_unique<InputPipeline>(inputSize, classes, slots, inputThreads);
+        if (augmentation) {
+            pipeline->augment(*augmentation);
+        }
     }
 }
 
-void Net::test(const MNIST::LabeledSamples& test)
+void Net::loadBatch(Replica& replica, const DatasetView& samples, int begin, int end)
 {
-    double corrects = 0;
-    for (int i = 0; i < test.size(); ++i) {
-        Mat out = predict(test[i].second);
-        corrects += (ArgMax(out) == ArgMax(test[i].first)) ? 1 : 0;
+    const int batch = end - begin;
+    const int pixels = inputSize.height * inputSize.width * inputSize.depth;
+
+    if (replica.input.getRawSize() == 0) {
+        replica.input = Tensor(inputSize);
+    }
+    replica.input.setBatch(batch);
+    replica.labels.assign(batch * classes, 0);
+    for (int n = 0; n < batch; ++n) {
+        const uint8_t* image = samples.image(begin + n);
+        Scalar* input = replica.input.data(n);
+        for (int i = 0; i < pixels; ++i) {
+            input[i] = image[i] / Scalar(255);
+        }
+        replica.labels[n * classes + samples.label(begin + n)] = 1;
     }
-    std::cout << "correct/total = " << corrects / test.size() << std::endl;
 }
 
-Mat Net::predict(const Tensor& input)
+Net::TrainStats Net::train(const DatasetView& train, double alpha, int batch_size, int threads, ETrainMode mode, TrainProgress* progress)
 {
-    Conv2d in;
-    in.setOutput(input);
-    if (!layers2d.empty()) {
-        layers2d[0]->feedForward(in);
+    const int start = progress ? progress->sample : 0;
+    assert(start < train.size() && batch_size > 0 && threads > 0);
+
+    if (!tunedForTraining) {
+        // the replicas take over the first one's algorithms when they are cloned
+        replicas.erase(replicas.begin() + 1, replicas.end());
+        replicas[0].layers.tuneConvolutions(true);
+        tunedForTraining = true;
     }
-    for (int d = 1; d < layers2d.size(); ++d) {
-        layers2d[d]->feedForward(*layers2d[d - 1]);
+    addReplicas(threads);
+    reserveWorkspaces(batch_size);
+    usePool(threads);
+    // enough batches in flight for every Hogwild thread to have the next one waiting
+    usePipeline(std::max(4, 2 * threads));
+    pipeline->start(train, start, batch_size);
+    if (progress) {
+        progress->order.assign(train.getIndices().begin(), train.getIndices().end());
     }
-    Mat flatted = (layers2d.empty()) ? Flatten(in.getOut()) : Flatten(layers2d.back()->getOut());
-    layers[0]->feedForward(flatted);
-    for (int f = 1; f < layers.size(); ++f) {
-        layers[f]->feedForward(layers[f - 1]->getOut());
+
+    const long long allocations = AllocationCount();
+    const auto start_time = std::chrono::steady_clock::now();
+    const int corrects = (mode == ETrainMode::Hogwild) ?
+        trainHogwild(train, alpha, threads) :
+        trainSynchronous(train, alpha, threads, progress);
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+    pipeline->finish();
+
+    if (progress) {
+        progress->sample = train.size();
+        if (checkpointWriter) {
+            checkpointWriter->snapshot(params, paramCount, *progress);
+            sinceCheckpoint = 0;
+        }
     }
-    return layers.back()->getOut();
+
+    TrainStats stats;
+    stats.images_per_sec = (train.size() - start) / elapsed.count();
+    stats.accuracy = double(corrects) / (train.size() - start);
+    stats.allocations = AllocationCount() - allocations;
+    stats.input_stalls = pipeline->getStalls();
+    return stats;
 }
 
-Mat Net::forward(const Tensor& input)
+int Net::trainSynchronous(const DatasetView& train, double alpha, int threads, TrainProgress* progress)
 {
-    assert(!layers.empty());
+    int total = 0;
+    int corrects = 0;
+    for (int b = 0; b < pipeline->getBatchCount(); ++b) {
+        const InputPipeline::Batch& ready = pipeline->acquire(b);
+        const int i = ready.begin;
+        const int batch = ready.input.batch();
+        const int shards = std::min(threads, batch);
+
+        pool->parallelFor(shards, [&](int t) {
+            Replica& replica = replicas[t];
+            const int first = batch * t / shards;
+            const int last = batch * (t + 1) / shards;
+            Tensor::Size size = inputSize;
+            size.batch = last - first;
+            replica.labels.assign(ready.labels.begin() + first * classes, ready.labels.begin() + last * classes);
+            replica.layers.forward(TensorView(ready.input.data(first), size));
+            backprop(replica, replica.labels);
+        });
 
-    if (!layers2d.empty()) {
-        Conv2d in;
-        in.setOutput(input);
-        layers2d[0]->feedForward(in);
-        for (int i = 1; i < layers2d.size(); ++i) {
-            layers2d[i]->feedForward(*layers2d[i - 1]);
+        {
+            // one read of each replica's gradients and a read and write of the parameters
+            PROFILE_SCOPE("Net.update", 2.0 * shards * paramCount, (shards + 2.0) * paramCount * sizeof(Scalar));
+            // sum the replicas' gradients and apply them, each thread owning a slice of the parameters
+            const Scalar rate = alpha / batch;
+            pool->parallelFor(threads, [&](int t) {
+                const int begin = paramCount * t / threads;
+                const int end = paramCount * (t + 1) / threads;
+                for (int r = 0; r < shards; ++r) {
+                    Simd().axpy(end - begin, -rate, replicas[r].grads.data() + begin, params + begin);
+                }
+            });
+            for (auto& replica : replicas) {
+                replica.layers.onParamsUpdated();
+            }
         }
 
-    }
+        // the parameters hold exactly the batches before i + batch, a consistent point to resume from
+        sinceCheckpoint += batch;
+        if (progress) {
+            progress->sample = i + batch;
+            if (checkpointWriter && sinceCheckpoint >= checkpointInterval && i + batch < train.size()) {
+                checkpointWriter->snapshot(params, paramCount, *progress);
+                sinceCheckpoint = 0;
+            }
+        }
 
-    Mat flatted = (layers2d.empty()) ? Flatten(input) : Flatten(layers2d.back()->getOut());
-    layers[0]->feedForward(flatted);
-    for (int i = 1; i < layers.size(); ++i) {
-        layers[i]->feedForward(layers[i - 1]->getOut());
+        for (int t = 0, sample = i; t < shards; ++t) {
+            const Mat& out = replicas[t].layers.getOut();
+            const int shard = batch * (t + 1) / shards - batch * t / shards;
+            for (int n = 0; n < shard; ++n, ++sample) {
+                const int correct = (ArgMax(out.data() + n * classes, classes) == train.label(sample)) ? 1 : 0;
+                corrects += correct;
+                total += correct;
+                if (sample % 100 == 0) {
+                    std::cout << "#" << sample << " " << double(corrects) / 100 << std::endl;
+                    corrects = 0;
+                }
+            }
+        }
+        pipeline->release(b);
     }
+    return total;
+}
+
+int Net::trainHogwild(const DatasetView& train, double alpha, int threads)
+{
+    std::atomic<int> corrects(0);
+
+    // Thread t takes every threads-th mini-batch. Updates race with the other threads'
+    // reads and writes of the same parameters: a lost or stale update only perturbs one
+    // step of SGD. The writes all go through hogwildAxpy, which documents what the race
+    // relies on and skips zero gradients, keeping the threads off each other's cache lines
+    // for inactive units.
+    pool->parallelFor(threads, [&](int t) {
+        Replica& replica = replicas[t];
+        Scalar* shared = params;
+        const Scalar* grads = replica.grads.data();
+        int threadCorrects = 0;
 
-    return layers.back()->getOut();
+        for (int b = t; b < pipeline->getBatchCount(); b += threads) {
+            const InputPipeline::Batch& ready = pipeline->acquire(b);
+            const int i = ready.begin;
+            const int batch = ready.input.batch();
+            const Mat& out = replica.layers.forward(ready.input);
+            for (int n = 0; n < batch; ++n) {
+                threadCorrects += (ArgMax(out.data() + n * classes, classes) == train.label(i + n)) ? 1 : 0;
+            }
+            backprop(replica, ready.labels);
+            pipeline->release(b);
+
+            Simd().hogwildAxpy(paramCount, -Scalar(alpha / batch), grads, shared);
+            replica.layers.onParamsUpdated();
+        }
+        corrects += threadCorrects;
+    });
+    return corrects;
 }
 
-void Net::backprop(const Mat& y, double alpha)
+Net::TestStats Net::test(const DatasetView& test, int batch_size, int threads)
 {
-    assert(!layers.empty());
+    assert(test.size() > 0 && batch_size > 0 && threads > 0);
+
+    addReplicas(threads);
+    usePool(threads);
+    confusions.resize(threads);
+    for (auto& confusion : confusions) {
+        confusion.assign(classes * classes, 0);
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    // thread t takes every threads-th batch; forward passes only touch the replica's activations
+    pool->parallelFor(threads, [&](int t) {
+        Replica& replica = replicas[t];
+        std::vector<int>& confusion = confusions[t];
+        for (int i = t * batch_size; i < test.size(); i += threads * batch_size) {
+            const int end = std::min<int>(i + batch_size, test.size());
+            loadBatch(replica, test, i, end);
+            const Mat& out = replica.layers.forward(replica.input);
+            for (int n = 0; n < end - i; ++n) {
+                ++confusion[test.label(i + n) * classes + ArgMax(out.data() + n * classes, classes)];
+            }
+        }
+    });
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
 
-    layers.back()->backProp(y, alpha);
-    for (int i = layers.size() - 2; i >= 0; --i) {
-        layers[i]->backProp(layers[i + 1]->getDlDx(), alpha);
+    TestStats stats;
+    stats.classes = classes;
+    stats.images_per_sec = test.size() / elapsed.count();
+    stats.confusion.assign(classes * classes, 0);
+    for (const auto& confusion : confusions) {
+        for (int i = 0; i < classes * classes; ++i) {
+            stats.confusion[i] += confusion[i];
+        }
     }
 
-    if (!layers2d.empty()) {
-        Tensor tensored_dL_dX = layers[0]->getTensorDlDx(layers2d.back()->getOutputSize());
-        layers2d.back()->backProp(tensored_dL_dX, alpha);
-        for (int i = layers2d.size() - 2; i >= 0; --i) {
-            layers2d[i]->backProp(layers2d[i + 1]->getDlDx(), alpha);
+    int corrects = 0;
+    stats.precision.resize(classes);
+    stats.recall.resize(classes);
+    for (int c = 0; c < classes; ++c) {
+        int predicted = 0;
+        int actual = 0;
+        for (int k = 0; k < classes; ++k) {
+            predicted += stats.confusion[k * classes + c];
+            actual += stats.confusion[c * classes + k];
         }
+        const int hits = stats.confusion[c * classes + c];
+        corrects += hits;
+        stats.precision[c] = predicted ? double(hits) / predicted : 0;
+        stats.recall[c] = actual ? double(hits) / actual : 0;
+    }
+    stats.accuracy = double(corrects) / test.size();
+
+    std::cout << "correct/total = " << stats.accuracy << std::endl;
+    return stats;
+}
+
+InferenceContext Net::createContext(int batch) const
+{
+    InferenceContext context(replicas[0].layers.clone());
+    context.layers.bind(params, nullptr, nullptr);
+    Tensor::Size size = inputSize;
+    size.batch = batch;
+    context.layers.forward(Tensor(size));
+    return context;
+}
+
+const Mat& Net::predict(const TensorView& input, InferenceContext& context) const
+{
+    return context.layers.forward(input);
+}
+
+std::shared_ptr<const Model> Net::exportModel() const
+{
+    return std::make_shared<Model>(topology2d, topology, params, paramCount);
+}
+
+void Net::backprop(Replica& replica, const Mat& y)
+{
+    replica.workspace->reset();
+    replica.layers.backprop(y);
+}
+
+std::ostream& operator<<(std::ostream& out, const Net::TestStats& stats)
+{
+    out << "accuracy " << stats.accuracy << ", " << stats.images_per_sec << " images/sec" << std::endl;
+    out << "confusion (rows: label, columns: prediction)" << std::endl;
+    for (int c = 0; c < stats.classes; ++c) {
+        out << c << ":";
+        for (int k = 0; k < stats.classes; ++k) {
+            out << " " << stats.confusion[c * stats.classes + k];
+        }
+        out << std::endl;
+    }
+    for (int c = 0; c < stats.classes; ++c) {
+        out << "class " << c << ": precision " << stats.precision[c] << ", recall " << stats.recall[c] << std::endl;
     }
+    return out;
 }
@@ -1,21 +1,123 @@
 #pragma once
-#include "Layer.h"
-#include "Layer2d.h"
+#include "LayerStack.h"
+#include "Model.h"
+#include "Checkpoint.h"
+#include "CheckpointWriter.h"
+#include "InputPipeline.h"
 #include "MNIST.h"
+#include "ThreadPool.h"
 #include <memory>
 
+enum class ETrainMode {
+    // every mini-batch is split across the threads, gradients are summed and applied once
+    Synchronous,
+    // every thread trains on its own mini-batches and writes its updates straight into
+    // the shared parameters, without locks or barriers (Hogwild!)
+    Hogwild
+};
+
 class Net
 {
+public:
+    struct TrainStats {
+        double images_per_sec;
+        double accuracy;
+        // heap allocations made while training, 0 once the buffers have reached their size
+        // (writing a checkpoint in the background allocates as well)
+        long long allocations;
+        // mini-batches the training threads had to wait for, 0 when the input pipeline keeps up
+        int input_stalls;
+    };
+    struct TestStats {
+        double accuracy;
+        double images_per_sec;
+        int classes;
+        // classes x classes, row = true label, column = prediction
+        std::vector<int> confusion;
+        // per class: correct predictions of it over all predictions of it, and over all its samples
+        std::vector<double> precision;
+        std::vector<double> recall;
+    };
 public:
     Net(const std::vector<Layer2d::Topology>& topology2d, const std::vector<Layer::Topology>& topology);
-    void train(const MNIST::LabeledSamples& train, double alpha);
-    void test(const MNIST::LabeledSamples& test);
-    Mat predict(const Tensor& input);
+    // Restores a Net written by save(). The parameters stay in the mapped checkpoint,
+    // training copies only the pages it updates.
+    explicit Net(const std::string& path);
+    void save(const std::string& path, const TrainProgress& progress = TrainProgress()) const;
+    // What the checkpoint this Net was restored from says about the run, empty otherwise
+    TrainProgress getProgress() const;
+    // From now on train() hands a snapshot to a background writer every `interval`
+    // samples and at the end of each call. Synchronous training resumes from the sample
+    // of the last checkpoint, Hogwild only from its epoch.
+    void checkpointEvery(const std::string& path, int interval);
+    // Background threads that prepare the mini-batches of train(), 1 by default
+    void setInputThreads(int threads);
+    // Every later train() sees randomly distorted variants of its samples
+    void augment(const Augmenter::Options& options);
+
+    // One pass over train, starting at progress->sample when progress is given; the
+    // progress is advanced and ends up in the checkpoints
+    TrainStats train(const DatasetView& train, double alpha, int batch_size = 1, int threads = 1,
+        ETrainMode mode = ETrainMode::Synchronous, TrainProgress* progress = nullptr);
+    // Batches are spread over the threads, each counts into its own confusion matrix
+    TestStats test(const DatasetView& test, int batch_size = 64, int threads = 1);
+
+    // Forward passes with the current parameters, through a context of the caller's.
+    // Reentrant, but not safe while train() updates the parameters.
+    InferenceContext createContext(int batch = 1) const;
+    const Mat& predict(const TensorView& input, InferenceContext& context) const;
+    // Immutable copy of the current network to serve from
+    std::shared_ptr<const Model> exportModel() const;
 private:
-    Mat forward(const Tensor& input);
-    void backprop(const Mat& y, double alpha);
+    // Copy of the layer stack with private activations and gradients, bound to the shared parameters
+    struct Replica {
+        LayerStack layers;
+        AlignedMat grads;
+        Tensor input;
+        Mat labels;
+        // layer temporaries; on the heap so the layers' pointers survive moving the replica
+        std::unique_ptr<Workspace> workspace;
+    };
+
+    // Builds the first replica's layers from the topology and counts the parameters
+    void createLayers();
+    // Binds the first replica once params points at the parameter storage
+    void bindFirstReplica();
+    void backprop(Replica& replica, const Mat& y);
+    void bind(Replica& replica);
+    void addReplicas(int count);
+    void reserveWorkspaces(int batch);
+    void usePool(int threads);
+    void usePipeline(int slots);
+    void loadBatch(Replica& replica, const DatasetView& samples, int begin, int end);
+    int trainSynchronous(const DatasetView& train, double alpha, int threads, TrainProgress* progress);
+    int trainHogwild(const DatasetView& train, double alpha, int threads);
 private:
-    std::vector<std::unique_ptr<Layer2d>> layers2d;
-    std::vector<std::unique_ptr<Layer>> layers;
+    std::vector<Layer2d::Topology> topology2d;
+    std::vector<Layer::Topology> topology;
+    Tensor::Size inputSize;
+    int classes;
+    // every layer's slice starts on a cache line, see AlignedParamCount; the storage is
+    // either owned or a mapped checkpoint
+    Scalar* params = nullptr;
+    int paramCount = 0;
+    AlignedMat ownedParams;
+    std::unique_ptr<Checkpoint> checkpoint;
+    std::unique_ptr<CheckpointWriter> checkpointWriter;
+    int checkpointInterval = 0;
+    // samples trained since the last snapshot
+    int sinceCheckpoint = 0;
+    std::vector<Replica> replicas;
+    // the convolutions are tuned for forward passes on construction, the first train()
+    // tunes the backward passes as well
+    bool tunedForTraining = false;
+    std::unique_ptr<ThreadPool> pool;
+    std::unique_ptr<InputPipeline> pipeline;
+    int inputThreads = 1;
+    std::unique_ptr<Augmenter::Options> augmentation;
+    // one classes x classes matrix per test thread
+    std::vector<std::vector<int>> confusions;
 };
 
+// Accuracy, throughput, the confusion matrix and precision and recall per class
+std::ostream& operator<<(std::ostream& out, const Net::TestStats& stats);
@@ -0,0 +1,209 @@
+#include "Profiler.h"
+
+#ifdef MNIST_CNN_PROFILE
+#include "AllocationCounter.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+    struct Event {
+        const char* name;
+        long long start;
+        long long duration;
+        double flops;
+        double bytes;
+        long long allocations;
+    };
+
+    // Written only by its thread: the event goes in first, then the release store of count
+    // publishes it. Full buffers drop events rather than grow under the readers.
+    struct ThreadBuffer {
+        int thread;
+        size_t capacity;
+        // default-initialized, so only the pages events land in get touched
+        std::unique_ptr<Event[]> events;
+        std::atomic<size_t> count{ 0 };
+        std::atomic<long long> dropped{ 0 };
+    };
+
+    typedef std::chrono::steady_clock Clock;
+    const Clock::time_point EPOCH = Clock::now();
+
+    std::mutex registryMutex;
+    // buffers outlive their threads, so a dump after the workers exited still sees them
+    std::vector<std::unique_ptr<ThreadBuffer>> registry;
+    // node-based, the strings never move
+    std::set<std::string> interned;
+
+    long long Now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - EPOCH).count();
+    }
+
+    // MNIST_CNN_PROFILE_EVENTS events per thread, a million by default
+    size_t Capacity()
+    {
+        const char* events = std::getenv("MNIST_CNN_PROFILE_EVENTS");
+        return events ? std::strtoull(events, nullptr, 10) : (1 << 20);
+    }
+
+    ThreadBuffer& LocalBuffer()
+    {
+        thread_local ThreadBuffer* buffer = nullptr;
+        if (!buffer) {
+            auto created = std::make_unique<ThreadBuffer>();
+            created->capacity = Capacity();
+            created->events.reset(new Event[created->capacity]);
+            std::lock_guard<std::mutex> lock(registryMutex);
+            created->thread = registry.size();
+            buffer = created.get();
+            registry.push_back(std::move(created));
+        }
+        return *buffer;
+    }
+
+    void WriteEscaped(std::ostream& out, const char* text)
+    {
+        for (; *text; ++text) {
+            if (*text == '"' || *text == '\\') {
+                out << '\\';
+            }
+            out << *text;
+        }
+    }
+}
+
+ProfileScope::ProfileScope(const char* name, double flops, double bytes) :
+    name(name),
+    flops(flops),
+    bytes(bytes)
+{
+    // the first scope of a thread allocates its buffer before the count starts
+    LocalBuffer();
+    allocations = ThreadAllocationCount();
+    start = Now();
+}
+
+ProfileScope::~ProfileScope()
+{
+    const long long end = Now();
+    ThreadBuffer& buffer = LocalBuffer();
+    const size_t n = buffer.count.load(std::memory_order_relaxed);
+    if (n == buffer.capacity) {
+        buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    buffer.events[n] = { name, start, end - start, flops, bytes, ThreadAllocationCount() - allocations };
+    buffer.count.store(n + 1, std::memory_order_release);
+}
+
+void Profiler::WriteChromeTrace(const std::string& path)
+{
+    std::ofstream out(path);
+    if (!out) {
+        throw std::runtime_error("cannot write " + path);
+    }
+    std::lock_guard<std::mutex> lock(registryMutex);
+    out << "{\"traceEvents\": [";
+    bool first = true;
+    for (const auto& buffer : registry) {
+        out << (first ? "\n" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->thread
+            << ", \"args\": {\"name\": \"thread " << buffer->thread << "\"}}";
+        first = false;
+        const size_t count = buffer->count.load(std::memory_order_acquire);
+        for (size_t i = 0; i < count; ++i) {
+            const Event& e = buffer->events[i];
+            out << ",\n{\"name\": \"";
+            WriteEscaped(out, e.name);
+            // microseconds, the unit of the format
+            out << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->thread << std::fixed << std::setprecision(3)
+                << ", \"ts\": " << e.start / 1e3 << ", \"dur\": " << e.duration / 1e3 << std::defaultfloat
+                << ", \"args\": {\"flops\": " << e.flops << ", \"bytes\": " << e.bytes
+                << ", \"allocations\": " << e.allocations << "}}";
+        }
+    }
+    out << "\n]}" << std::endl;
+}
+
+void Profiler::PrintSummary(std::ostream& out)
+{
+    struct Total {
+        long long calls = 0;
+        long long time = 0;
+        double flops = 0;
+        double bytes = 0;
+        long long allocations = 0;
+    };
+    std::map<std::string, Total> totals;
+    long long begin = -1;
+    long long end = 0;
+    long long dropped = 0;
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        for (const auto& buffer : registry) {
+            const size_t count = buffer->count.load(std::memory_order_acquire);
+            for (size_t i = 0; i < count; ++i) {
+                const Event& e = buffer->events[i];
+                Total& total = totals[e.name];
+                ++total.calls;
+                total.time += e.duration;
+                total.flops += e.flops;
+                total.bytes += e.bytes;
+                total.allocations += e.allocations;
+                begin = (begin < 0) ? e.start : std::min(begin, e.start);
+                end = std::max(end, e.start + e.duration);
+            }
+            dropped += buffer->dropped.load(std::memory_order_relaxed);
+        }
+    }
+    if (totals.empty()) {
+        out << "no profiled scopes ran" << std::endl;
+        return;
+    }
+
+    // nested scopes are counted in their parents too, so the shares add up to more than 100%
+    std::vector<std::pair<std::string, Total>> rows(totals.begin(), totals.end());
+    std::sort(rows.begin(), rows.end(), [](const auto& a, const auto& b) { return a.second.time > b.second.time; });
+    const double window = double(end - begin);
+    out << std::left << std::setw(32) << "scope" << std::right << std::setw(10) << "calls" << std::setw(12) << "total ms"
+        << std::setw(12) << "mean us" << std::setw(9) << "% wall" << std::setw(10) << "GFLOP/s" << std::setw(10) << "GB/s"
+        << std::setw(10) << "allocs" << std::endl;
+    for (const auto& row : rows) {
+        const Total& t = row.second;
+        out << std::left << std::setw(32) << row.first << std::right << std::fixed << std::setw(10) << t.calls
+            << std::setprecision(1) << std::setw(12) << t.time / 1e6 << std::setw(12) << t.time / 1e3 / t.calls
+            << std::setw(9) << 100 * t.time / window << std::setprecision(2)
+            << std::setw(10) << (t.time ? t.flops / t.time : 0) << std::setw(10) << (t.time ? t.bytes / t.time : 0)
+            << std::setw(10) << t.allocations << std::defaultfloat << std::endl;
+    }
+    if (dropped) {
+        out << dropped << " events dropped, raise MNIST_CNN_PROFILE_EVENTS to keep them" << std::endl;
+    }
+}
+
+const char* Profiler::Intern(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    return interned.insert(name).first->c_str();
+}
+
+void Profiler::Reset()
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (const auto& buffer : registry) {
+        buffer->count.store(0, std::memory_order_relaxed);
+        buffer->dropped.store(0, std::memory_order_relaxed);
+    }
+}
+#endif
@@ -0,0 +1,50 @@
+#pragma once
+
+// Scoped timers for training and inference, compiled in only with MNIST_CNN_PROFILE defined.
+// Otherwise PROFILE_SCOPE expands to nothing and its arguments are never evaluated.
+//
+//   PROFILE_SCOPE(name, flops, bytes);
+//
+// times the rest of the enclosing block under name, a literal or a string from
+// Profiler::Intern, along with the FLOPs and the bytes the block moves and the heap
+// allocations the thread makes inside it. Each thread records into a buffer of its own
+// without locks; the buffers are read by the dump functions, which the caller runs once
+// the timed threads are quiet.
+#ifdef MNIST_CNN_PROFILE
+#include <iosfwd>
+#include <string>
+
+class Profiler
+{
+public:
+    // Everything recorded so far, as Chrome trace events (chrome://tracing, Perfetto)
+    static void WriteChromeTrace(const std::string& path);
+    // Calls, time, throughput and allocations per name
+    static void PrintSummary(std::ostream& out);
+    // Forgets the recorded events
+    static void Reset();
+    // A copy of name that lives until the process exits, for names built at run time
+    static const char* Intern(const std::string& name);
+};
+
+class ProfileScope
+{
+public:
+    ProfileScope(const char* name, double flops = 0, double bytes = 0);
+    ~ProfileScope();
+    ProfileScope(const ProfileScope&) = delete;
+    void operator=(const ProfileScope&) = delete;
+private:
+    const char* name;
+    double flops;
+    double bytes;
+    long long start;
+    long long allocations;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(...) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(__VA_ARGS__)
+#else
+#define PROFILE_SCOPE(...) ((void)0)
+#endif
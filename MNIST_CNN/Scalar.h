@@ -0,0 +1,9 @@
+#pragma once
+
+// Element type of tensors, parameters and every math kernel, fixed at compile time.
+// Single precision unless built with MNIST_CNN_DOUBLE.
+#ifdef MNIST_CNN_DOUBLE
+typedef double Scalar;
+#else
+typedef float Scalar;
+#endif
@@ -0,0 +1,944 @@
+#include "Simd.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define MNIST_CNN_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#if defined(MNIST_CNN_X86) && !defined(MNIST_CNN_DOUBLE)
+#define MNIST_CNN_SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+// MSVC accepts any intrinsic in any function
+#define SIMD_TARGET(isa)
+#else
+// GCC and Clang only emit instructions beyond the -m flags in functions marked for them
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+namespace {
+#ifdef MNIST_CNN_X86
+    void Cpuid(int leaf, int subleaf, unsigned regs[4])
+    {
+#ifdef _MSC_VER
+        __cpuidex(reinterpret_cast<int*>(regs), leaf, subleaf);
+#else
+        __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+    }
+#endif
+
+    const int MR = SimdKernels::MR;
+    const int NR = SimdKernels::NR;
+
+    void GemmTileScalar(int kc, const Scalar* a, const Scalar* b, Scalar* acc)
+    {
+        Scalar c[MR][NR] = {};
+        for (int p = 0; p < kc; ++p) {
+            for (int i = 0; i < MR; ++i) {
+                const Scalar ai = a[i];
+                for (int j = 0; j < NR; ++j) {
+                    c[i][j] += ai * b[j];
+                }
+            }
+            a += MR;
+            b += NR;
+        }
+        std::memcpy(acc, c, sizeof(c));
+    }
+
+    void AxpyScalar(int n, Scalar alpha, const Scalar* x, Scalar* y)
+    {
+        for (int i = 0; i < n; ++i) {
+            y[i] += alpha * x[i];
+        }
+    }
+
+    void HogwildAxpyScalar(int n, Scalar alpha, const Scalar* x, Scalar* y)
+    {
+        for (int i = 0; i < n; ++i) {
+            if (x[i] != 0) {
+                y[i] += alpha * x[i];
+            }
+        }
+    }
+
+    Scalar SumScalar(int n, const Scalar* x)
+    {
+        Scalar sum = 0;
+        for (int i = 0; i < n; ++i) {
+            sum += x[i];
+        }
+        return sum;
+    }
+
+    void ReluScalar(int n, Scalar* x)
+    {
+        for (int i = 0; i < n; ++i) {
+            x[i] = x[i] > 0 ? x[i] : 0;
+        }
+    }
+
+    void SigmoidScalar(int n, Scalar* x)
+    {
+        for (int i = 0; i < n; ++i) {
+            x[i] = 1 / (1 + std::exp(-x[i]));
+        }
+    }
+
+    Scalar ExpSumScalar(int n, Scalar shift, Scalar* x)
+    {
+        Scalar sum = 0;
+        for (int i = 0; i < n; ++i) {
+            x[i] = std::exp(x[i] - shift);
+            sum += x[i];
+        }
+        return sum;
+    }
+
+    void ReluBackwardScalar(int n, const Scalar* dA, const Scalar* out, Scalar* dZ)
+    {
+        for (int i = 0; i < n; ++i) {
+            dZ[i] = out[i] > 0 ? dA[i] : 0;
+        }
+    }
+
+    void SigmoidBackwardScalar(int n, const Scalar* dA, const Scalar* out, Scalar* dZ)
+    {
+        for (int i = 0; i < n; ++i) {
+            const Scalar sigmoid = 1 / (1 + std::exp(-out[i]));
+            dZ[i] = dA[i] * sigmoid * (1 - sigmoid);
+        }
+    }
+
+    void BilinearScalar(int n, const Scalar* image, int stride, Scalar maxX, Scalar maxY,
+        const Scalar* xs, const Scalar* ys, Scalar* out)
+    {
+        for (int i = 0; i < n; ++i) {
+            const Scalar x = std::min(std::max(xs[i], Scalar(0)), maxX);
+            const Scalar y = std::min(std::max(ys[i], Scalar(0)), maxY);
+            const int x0 = int(x);
+            const int y0 = int(y);
+            const Scalar fx = x - x0;
+            const Scalar fy = y - y0;
+            const Scalar* p = image + y0 * stride + x0;
+            const Scalar top = p[0] + fx * (p[1] - p[0]);
+            const Scalar bottom = p[stride] + fx * (p[stride + 1] - p[stride]);
+            out[i] = top + fy * (bottom - top);
+        }
+    }
+
+    const SimdKernels ScalarKernels = { "scalar", GemmTileScalar, AxpyScalar, HogwildAxpyScalar, SumScalar,
+        ReluScalar, SigmoidScalar, ExpSumScalar, ReluBackwardScalar, SigmoidBackwardScalar, BilinearScalar };
+
+#ifdef MNIST_CNN_SIMD_X86
+    // e^x = 2^k * e^r with k = round(x / ln 2) and |r| <= ln 2 / 2; e^r = 1 + r + r^2 * p(r)
+    // (Cephes expf). ln 2 is split in two so that k * ln 2 is exact enough.
+    const float EXP_MIN = -87.0f;
+    const float EXP_MAX = 88.0f;
+    const float LOG2E = 1.44269504088896341f;
+    const float LN2_HI = 0.693359375f;
+    const float LN2_LO = -2.12194440e-4f;
+    const float EXP_P[] = { 1.9875691500e-4f, 1.3981999507e-3f, 8.3334519073e-3f, 4.1665795894e-2f, 1.6666665459e-1f, 5.0000001201e-1f };
+
+    // --- SSE2: 4 floats per register, the 16-wide tile is done as two 4 x 8 halves ---
+
+    SIMD_TARGET("sse2")
+    float HorizontalSum(__m128 v)
+    {
+        v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+        v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+        return _mm_cvtss_f32(v);
+    }
+
+    SIMD_TARGET("sse2")
+    void GemmTileSse2(int kc, const float* a, const float* b, float* acc)
+    {
+        for (int half = 0; half < NR; half += 8) {
+            __m128 c[MR][2];
+            for (int i = 0; i < MR; ++i) {
+                c[i][0] = _mm_setzero_ps();
+                c[i][1] = _mm_setzero_ps();
+            }
+            const float* pa = a;
+            const float* pb = b + half;
+            for (int p = 0; p < kc; ++p) {
+                const __m128 b0 = _mm_loadu_ps(pb);
+                const __m128 b1 = _mm_loadu_ps(pb + 4);
+                for (int i = 0; i < MR; ++i) {
+                    const __m128 ai = _mm_set1_ps(pa[i]);
+                    c[i][0] = _mm_add_ps(c[i][0], _mm_mul_ps(ai, b0));
+                    c[i][1] = _mm_add_ps(c[i][1], _mm_mul_ps(ai, b1));
+                }
+                pa += MR;
+                pb += NR;
+            }
+            for (int i = 0; i < MR; ++i) {
+                _mm_storeu_ps(acc + i * NR + half, c[i][0]);
+                _mm_storeu_ps(acc + i * NR + half + 4, c[i][1]);
+            }
+        }
+    }
+
+    SIMD_TARGET("sse2")
+    void AxpySse2(int n, float alpha, const float* x, float* y)
+    {
+        const __m128 va = _mm_set1_ps(alpha);
+        int i = 0;
+        for (; i + 4 <= n; i += 4) {
+            _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(va, _mm_loadu_ps(x + i))));
+        }
+        AxpyScalar(n - i, alpha, x + i, y + i);
+    }
+
+    SIMD_TARGET("sse2")
+    void HogwildAxpySse2(int n, float alpha, const float* x, float* y)
+    {
+        // SSE2 has no masked store, a group with any gradient is written whole; the
+        // elements without one get their value back unchanged
+        const __m128 va = _mm_set1_ps(alpha);
+        const __m128 zero = _mm_setzero_ps();
+        int i = 0;
+        for (; i + 4 <= n; i += 4) {
+            const __m128 vx = _mm_loadu_ps(x + i);
+            if (_mm_movemask_ps(_mm_cmpneq_ps(vx, zero)) != 0) {
+                _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(va, vx)));
+            }
+        }
+        HogwildAxpyScalar(n - i, alpha, x + i, y + i);
+    }
+
+    SIMD_TARGET("sse2")
+    float SumSse2(int n, const float* x)
+    {
+        __m128 sum = _mm_setzero_ps();
+        int i = 0;
+        for (; i + 4 <= n; i += 4) {
+            sum = _mm_add_ps(sum, _mm_loadu_ps(x + i));
+        }
+        return HorizontalSum(sum) + SumScalar(n - i, x + i);
+    }
+
+    SIMD_TARGET("sse2")
+    void ReluBackwardSse2(int n, const float* dA, const float* out, float* dZ)
+    {
+        const __m128 zero = _mm_setzero_ps();
+        int i = 0;
+        for (; i + 4 <= n; i += 4) {
+            const __m128 active = _mm_cmpgt_ps(_mm_loadu_ps(out + i), zero);
+            _mm_storeu_ps(dZ + i, _mm_and_ps(active, _mm_loadu_ps(dA + i)));
+        }
+        ReluBackwardScalar(n - i, dA + i, out + i, dZ + i);
+    }
+
+    SIMD_TARGET("sse2")
+    __m128 ExpSse2(__m128 x)
+    {
+        x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(EXP_MIN)), _mm_set1_ps(EXP_MAX));
+        const __m128i k = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(LOG2E)));
+        const __m128 fk = _mm_cvtepi32_ps(k);
+        const __m128 r = _mm_sub_ps(_mm_sub_ps(x, _mm_mul_ps(fk, _mm_set1_ps(LN2_HI))), _mm_mul_ps(fk, _mm_set1_ps(LN2_LO)));
+        __m128 p = _mm_set1_ps(EXP_P[0]);
+        for (int c = 1; c < 6; ++c) {
+            p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(EXP_P[c]));
+        }
+        p = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(r, r), p), r), _mm_set1_ps(1));
+        const __m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(k, _mm_set1_epi32(127)), 23));
+        return _mm_mul_ps(p, scale);
+    }
+
+    SIMD_TARGET("sse2")
+    __m128 SigmoidSse2(__m128 x)
+    {
+        const __m128 one = _mm_set1_ps(1);
+        return _mm_div_ps(one, _mm_add_ps(one, ExpSse2(_mm_sub_ps(_mm_setzero_ps(), x))));
+    }
+
+    SIMD_TARGET("sse2")
+    void ReluSse2(int n, float* x)
+    {
+        const __m128 zero = _mm_setzero_ps();
+        int i = 0;
+        for (; i + 4 <= n; i += 4) {
+            _mm_storeu_ps(x + i, _mm_max_ps(_mm_loadu_ps(x + i), zero));
+        }
+        ReluScalar(n - i, x + i);
+    }
+
+    SIMD_TARGET("sse2")
+    void SigmoidSse2(int n, float* x)
+    {
+        int i = 0;
+        for (; i + 4 <= n; i += 4) {
+            _mm_storeu_ps(x + i, SigmoidSse2(_mm_loadu_ps(x + i)));
+        }
+        SigmoidScalar(n - i, x + i);
+    }
+
+    SIMD_TARGET("sse2")
+    float ExpSumSse2(int n, float shift, float* x)
+    {
+        const __m128 vShift = _mm_set1_ps(shift);
+        __m128 sum = _mm_setzero_ps();
+        int i = 0;
+        for (; i + 4 <= n; i += 4) {
+            const __m128 e = ExpSse2(_mm_sub_ps(_mm_loadu_ps(x + i), vShift));
+            _mm_storeu_ps(x + i, e);
+            sum = _mm_add_ps(sum, e);
+        }
+        return HorizontalSum(sum) + ExpSumScalar(n - i, shift, x + i);
+    }
+
+    SIMD_TARGET("sse2")
+    void SigmoidBackwardSse2(int n, const float* dA, const float* out, float* dZ)
+    {
+        const __m128 one = _mm_set1_ps(1);
+        int i = 0;
+        for (; i + 4 <= n; i += 4) {
+            const __m128 sigmoid = SigmoidSse2(_mm_loadu_ps(out + i));
+            _mm_storeu_ps(dZ + i, _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(dA + i), sigmoid), _mm_sub_ps(one, sigmoid)));
+        }
+        SigmoidBackwardScalar(n - i, dA + i, out + i, dZ + i);
+    }
+
+    // SSE2 has no gather, the four corners are loaded lane by lane
+    SIMD_TARGET("sse2")
+    void BilinearSse2(int n, const float* image, int stride, float maxX, float maxY,
+        const float* xs, const float* ys, float* out)
+    {
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 vMaxX = _mm_set1_ps(maxX);
+        const __m128 vMaxY = _mm_set1_ps(maxY);
+        const __m128 vStride = _mm_set1_ps(float(stride));
+        int i = 0;
+        for (; i + 4 <= n; i += 4) {
+            const __m128 x = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(xs + i), zero), vMaxX);
+            const __m128 y = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(ys + i), zero), vMaxY);
+            const __m128 x0 = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+            const __m128 y0 = _mm_cvtepi32_ps(_mm_cvttps_epi32(y));
+            const __m128 fx = _mm_sub_ps(x, x0);
+            const __m128 fy = _mm_sub_ps(y, y0);
+            // exact in float for any image that fits in memory of this size
+            alignas(16) int offsets[4];
+            _mm_store_si128(reinterpret_cast<__m128i*>(offsets), _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(y0, vStride), x0)));
+            const float* p0 = image + offsets[0];
+            const float* p1 = image + offsets[1];
+            const float* p2 = image + offsets[2];
+            const float* p3 = image + offsets[3];
+            const __m128 a = _mm_setr_ps(p0[0], p1[0], p2[0], p3[0]);
+            const __m128 b = _mm_setr_ps(p0[1], p1[1], p2[1], p3[1]);
+            const __m128 c = _mm_setr_ps(p0[stride], p1[stride], p2[stride], p3[stride]);
+            const __m128 d = _mm_setr_ps(p0[stride + 1], p1[stride + 1], p2[stride + 1], p3[stride + 1]);
+            const __m128 top = _mm_add_ps(a, _mm_mul_ps(fx, _mm_sub_ps(b, a)));
+            const __m128 bottom = _mm_add_ps(c, _mm_mul_ps(fx, _mm_sub_ps(d, c)));
+            _mm_storeu_ps(out + i, _mm_add_ps(top, _mm_mul_ps(fy, _mm_sub_ps(bottom, top))));
+        }
+        BilinearScalar(n - i, image, stride, maxX, maxY, xs + i, ys + i, out + i);
+    }
+
+    // --- AVX2 + FMA: 8 floats per register, 4 x 2 accumulators ---
+
+    SIMD_TARGET("avx2,fma")
+    void GemmTileAvx2(int kc, const float* a, const float* b, float* acc)
+    {
+        __m256 c[MR][2];
+        for (int i = 0; i < MR; ++i) {
+            c[i][0] = _mm256_setzero_ps();
+            c[i][1] = _mm256_setzero_ps();
+        }
+        for (int p = 0; p < kc; ++p) {
+            const __m256 b0 = _mm256_loadu_ps(b);
+            const __m256 b1 = _mm256_loadu_ps(b + 8);
+            for (int i = 0; i < MR; ++i) {
+                const __m256 ai = _mm256_broadcast_ss(a + i);
+                c[i][0] = _mm256_fmadd_ps(ai, b0, c[i][0]);
+                c[i][1] = _mm256_fmadd_ps(ai, b1, c[i][1]);
+            }
+            a += MR;
+            b += NR;
+        }
+        for (int i = 0; i < MR; ++i) {
+            _mm256_storeu_ps(acc + i * NR, c[i][0]);
+            _mm256_storeu_ps(acc + i * NR + 8, c[i][1]);
+        }
+    }
+
+    SIMD_TARGET("avx2,fma")
+    void AxpyAvx2(int n, float alpha, const float* x, float* y)
+    {
+        const __m256 va = _mm256_set1_ps(alpha);
+        int i = 0;
+        for (; i + 8 <= n; i += 8) {
+            _mm256_storeu_ps(y + i, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+        }
+        AxpyScalar(n - i, alpha, x + i, y + i);
+    }
+
+    SIMD_TARGET("avx2,fma")
+    void HogwildAxpyAvx2(int n, float alpha, const float* x, float* y)
+    {
+        const __m256 va = _mm256_set1_ps(alpha);
+        const __m256 zero = _mm256_setzero_ps();
+        int i = 0;
+        for (; i + 8 <= n; i += 8) {
+            const __m256 vx = _mm256_loadu_ps(x + i);
+            const __m256 nonzero = _mm256_cmp_ps(vx, zero, _CMP_NEQ_UQ);
+            if (_mm256_movemask_ps(nonzero) != 0) {
+                _mm256_maskstore_ps(y + i, _mm256_castps_si256(nonzero), _mm256_fmadd_ps(va, vx, _mm256_loadu_ps(y + i)));
+            }
+        }
+        HogwildAxpyScalar(n - i, alpha, x + i, y + i);
+    }
+
+    SIMD_TARGET("avx2,fma")
+    float SumAvx2(int n, const float* x)
+    {
+        __m256 sum = _mm256_setzero_ps();
+        int i = 0;
+        for (; i + 8 <= n; i += 8) {
+            sum = _mm256_add_ps(sum, _mm256_loadu_ps(x + i));
+        }
+        const __m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+        return HorizontalSum(half) + SumScalar(n - i, x + i);
+    }
+
+    SIMD_TARGET("avx2,fma")
+    void ReluBackwardAvx2(int n, const float* dA, const float* out, float* dZ)
+    {
+        const __m256 zero = _mm256_setzero_ps();
+        int i = 0;
+        for (; i + 8 <= n; i += 8) {
+            const __m256 active = _mm256_cmp_ps(_mm256_loadu_ps(out + i), zero, _CMP_GT_OQ);
+            _mm256_storeu_ps(dZ + i, _mm256_and_ps(active, _mm256_loadu_ps(dA + i)));
+        }
+        ReluBackwardScalar(n - i, dA + i, out + i, dZ + i);
+    }
+
+    SIMD_TARGET("avx2,fma")
+    __m256 ExpAvx2(__m256 x)
+    {
+        x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(EXP_MIN)), _mm256_set1_ps(EXP_MAX));
+        const __m256i k = _mm256_cvtps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(LOG2E)));
+        const __m256 fk = _mm256_cvtepi32_ps(k);
+        const __m256 r = _mm256_fnmadd_ps(fk, _mm256_set1_ps(LN2_LO), _mm256_fnmadd_ps(fk, _mm256_set1_ps(LN2_HI), x));
+        __m256 p = _mm256_set1_ps(EXP_P[0]);
+        for (int c = 1; c < 6; ++c) {
+            p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P[c]));
+        }
+        p = _mm256_add_ps(_mm256_fmadd_ps(_mm256_mul_ps(r, r), p, r), _mm256_set1_ps(1));
+        const __m256 scale = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(k, _mm256_set1_epi32(127)), 23));
+        return _mm256_mul_ps(p, scale);
+    }
+
+    SIMD_TARGET("avx2,fma")
+    __m256 SigmoidAvx2(__m256 x)
+    {
+        const __m256 one = _mm256_set1_ps(1);
+        return _mm256_div_ps(one, _mm256_add_ps(one, ExpAvx2(_mm256_sub_ps(_mm256_setzero_ps(), x))));
+    }
+
+    SIMD_TARGET("avx2,fma")
+    void ReluAvx2(int n, float* x)
+    {
+        const __m256 zero = _mm256_setzero_ps();
+        int i = 0;
+        for (; i + 8 <= n; i += 8) {
+            _mm256_storeu_ps(x + i, _mm256_max_ps(_mm256_loadu_ps(x + i), zero));
+        }
+        ReluScalar(n - i, x + i);
+    }
+
+    SIMD_TARGET("avx2,fma")
+    void SigmoidAvx2(int n, float* x)
+    {
+        int i = 0;
+        for (; i + 8 <= n; i += 8) {
+            _mm256_storeu_ps(x + i, SigmoidAvx2(_mm256_loadu_ps(x + i)));
+        }
+        SigmoidScalar(n - i, x + i);
+    }
+
+    SIMD_TARGET("avx2,fma")
+    float ExpSumAvx2(int n, float shift, float* x)
+    {
+        const __m256 vShift = _mm256_set1_ps(shift);
+        __m256 sum = _mm256_setzero_ps();
+        int i = 0;
+        for (; i + 8 <= n; i += 8) {
+            const __m256 e = ExpAvx2(_mm256_sub_ps(_mm256_loadu_ps(x + i), vShift));
+            _mm256_storeu_ps(x + i, e);
+            sum = _mm256_add_ps(sum, e);
+        }
+        const __m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+        return HorizontalSum(half) + ExpSumScalar(n - i, shift, x + i);
+    }
+
+    SIMD_TARGET("avx2,fma")
+    void SigmoidBackwardAvx2(int n, const float* dA, const float* out, float* dZ)
+    {
+        const __m256 one = _mm256_set1_ps(1);
+        int i = 0;
+        for (; i + 8 <= n; i += 8) {
+            const __m256 sigmoid = SigmoidAvx2(_mm256_loadu_ps(out + i));
+            _mm256_storeu_ps(dZ + i, _mm256_mul_ps(_mm256_mul_ps(_mm256_loadu_ps(dA + i), sigmoid), _mm256_sub_ps(one, sigmoid)));
+        }
+        SigmoidBackwardScalar(n - i, dA + i, out + i, dZ + i);
+    }
+
+    SIMD_TARGET("avx2,fma")
+    void BilinearAvx2(int n, const float* image, int stride, float maxX, float maxY,
+        const float* xs, const float* ys, float* out)
+    {
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 vMaxX = _mm256_set1_ps(maxX);
+        const __m256 vMaxY = _mm256_set1_ps(maxY);
+        const __m256i vStride = _mm256_set1_epi32(stride);
+        int i = 0;
+        for (; i + 8 <= n; i += 8) {
+            const __m256 x = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(xs + i), zero), vMaxX);
+            const __m256 y = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(ys + i), zero), vMaxY);
+            const __m256i x0 = _mm256_cvttps_epi32(x);
+            const __m256i y0 = _mm256_cvttps_epi32(y);
+            const __m256 fx = _mm256_sub_ps(x, _mm256_cvtepi32_ps(x0));
+            const __m256 fy = _mm256_sub_ps(y, _mm256_cvtepi32_ps(y0));
+            const __m256i offsets = _mm256_add_epi32(_mm256_mullo_epi32(y0, vStride), x0);
+            const __m256 a = _mm256_i32gather_ps(image, offsets, 4);
+            const __m256 b = _mm256_i32gather_ps(image + 1, offsets, 4);
+            const __m256 c = _mm256_i32gather_ps(image + stride, offsets, 4);
+            const __m256 d = _mm256_i32gather_ps(image + stride + 1, offsets, 4);
+            const __m256 top = _mm256_fmadd_ps(fx, _mm256_sub_ps(b, a), a);
+            const __m256 bottom = _mm256_fmadd_ps(fx, _mm256_sub_ps(d, c), c);
+            _mm256_storeu_ps(out + i, _mm256_fmadd_ps(fy, _mm256_sub_ps(bottom, top), top));
+        }
+        BilinearScalar(n - i, image, stride, maxX, maxY, xs + i, ys + i, out + i);
+    }
+
+    // --- AVX-512: a tile row per register; even and odd k steps go to separate
+    // accumulators to keep enough independent FMAs in flight ---
+
+    SIMD_TARGET("avx512f")
+    void GemmTileAvx512(int kc, const float* a, const float* b, float* acc)
+    {
+        __m512 even[MR];
+        __m512 odd[MR];
+        for (int i = 0; i < MR; ++i) {
+            even[i] = _mm512_setzero_ps();
+            odd[i] = _mm512_setzero_ps();
+        }
+        int p = 0;
+        for (; p + 2 <= kc; p += 2) {
+            const __m512 b0 = _mm512_loadu_ps(b);
+            const __m512 b1 = _mm512_loadu_ps(b + NR);
+            for (int i = 0; i < MR; ++i) {
+                even[i] = _mm512_fmadd_ps(_mm512_set1_ps(a[i]), b0, even[i]);
+                odd[i] = _mm512_fmadd_ps(_mm512_set1_ps(a[MR + i]), b1, odd[i]);
+            }
+            a += 2 * MR;
+            b += 2 * NR;
+        }
+        if (p < kc) {
+            const __m512 b0 = _mm512_loadu_ps(b);
+            for (int i = 0; i < MR; ++i) {
+                even[i] = _mm512_fmadd_ps(_mm512_set1_ps(a[i]), b0, even[i]);
+            }
+        }
+        for (int i = 0; i < MR; ++i) {
+            _mm512_storeu_ps(acc + i * NR, _mm512_add_ps(even[i], odd[i]));
+        }
+    }
+
+    SIMD_TARGET("avx512f")
+    void AxpyAvx512(int n, float alpha, const float* x, float* y)
+    {
+        const __m512 va = _mm512_set1_ps(alpha);
+        int i = 0;
+        for (; i + 16 <= n; i += 16) {
+            _mm512_storeu_ps(y + i, _mm512_fmadd_ps(va, _mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i)));
+        }
+        if (i < n) {
+            const __mmask16 tail = __mmask16((1u << (n - i)) - 1);
+            const __m512 vy = _mm512_maskz_loadu_ps(tail, y + i);
+            _mm512_mask_storeu_ps(y + i, tail, _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(tail, x + i), vy));
+        }
+    }
+
+    SIMD_TARGET("avx512f")
+    void HogwildAxpyAvx512(int n, float alpha, const float* x, float* y)
+    {
+        const __m512 va = _mm512_set1_ps(alpha);
+        const __m512 zero = _mm512_setzero_ps();
+        for (int i = 0; i < n; i += 16) {
+            const __mmask16 lanes = (n - i >= 16) ? __mmask16(0xffff) : __mmask16((1u << (n - i)) - 1);
+            const __m512 vx = _mm512_maskz_loadu_ps(lanes, x + i);
+            const __mmask16 nonzero = _mm512_mask_cmpneq_ps_mask(lanes, vx, zero);
+            if (nonzero != 0) {
+                _mm512_mask_storeu_ps(y + i, nonzero, _mm512_fmadd_ps(va, vx, _mm512_maskz_loadu_ps(nonzero, y + i)));
+            }
+        }
+    }
+
+    SIMD_TARGET("avx512f")
+    float SumAvx512(int n, const float* x)
+    {
+        __m512 sum = _mm512_setzero_ps();
+        int i = 0;
+        for (; i + 16 <= n; i += 16) {
+            sum = _mm512_add_ps(sum, _mm512_loadu_ps(x + i));
+        }
+        if (i < n) {
+            const __mmask16 tail = __mmask16((1u << (n - i)) - 1);
+            sum = _mm512_add_ps(sum, _mm512_maskz_loadu_ps(tail, x + i));
+        }
+        // spelled out rather than _mm512_reduce_add_ps, which trips -Wuninitialized in GCC 12 headers
+        float lanes[16];
+        _mm512_storeu_ps(lanes, sum);
+        return SumScalar(16, lanes);
+    }
+
+    SIMD_TARGET("avx512f")
+    void ReluBackwardAvx512(int n, const float* dA, const float* out, float* dZ)
+    {
+        const __m512 zero = _mm512_setzero_ps();
+        int i = 0;
+        for (; i + 16 <= n; i += 16) {
+            const __mmask16 active = _mm512_cmp_ps_mask(_mm512_loadu_ps(out + i), zero, _CMP_GT_OQ);
+            _mm512_storeu_ps(dZ + i, _mm512_maskz_mov_ps(active, _mm512_loadu_ps(dA + i)));
+        }
+        ReluBackwardScalar(n - i, dA + i, out + i, dZ + i);
+    }
+
+    // Every AVX-512 activation runs masked, the tail included, with the zero-masked forms
+    // of min, max and the conversions for the reason given in BilinearAvx512
+    SIMD_TARGET("avx512f")
+    __m512 ExpAvx512(__mmask16 lanes, __m512 x)
+    {
+        x = _mm512_maskz_min_ps(lanes, _mm512_maskz_max_ps(lanes, x, _mm512_set1_ps(EXP_MIN)), _mm512_set1_ps(EXP_MAX));
+        const __m512i k = _mm512_maskz_cvtps_epi32(lanes, _mm512_mul_ps(x, _mm512_set1_ps(LOG2E)));
+        const __m512 fk = _mm512_maskz_cvtepi32_ps(lanes, k);
+        const __m512 r = _mm512_fnmadd_ps(fk, _mm512_set1_ps(LN2_LO), _mm512_fnmadd_ps(fk, _mm512_set1_ps(LN2_HI), x));
+        __m512 p = _mm512_set1_ps(EXP_P[0]);
+        for (int c = 1; c < 6; ++c) {
+            p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(EXP_P[c]));
+        }
+        p = _mm512_add_ps(_mm512_fmadd_ps(_mm512_mul_ps(r, r), p, r), _mm512_set1_ps(1));
+        const __m512 scale = _mm512_castsi512_ps(_mm512_maskz_slli_epi32(lanes, _mm512_add_epi32(k, _mm512_set1_epi32(127)), 23));
+        return _mm512_mul_ps(p, scale);
+    }
+
+    SIMD_TARGET("avx512f")
+    __m512 SigmoidAvx512(__mmask16 lanes, __m512 x)
+    {
+        const __m512 one = _mm512_set1_ps(1);
+        return _mm512_div_ps(one, _mm512_add_ps(one, ExpAvx512(lanes, _mm512_sub_ps(_mm512_setzero_ps(), x))));
+    }
+
+    SIMD_TARGET("avx512f")
+    void ReluAvx512(int n, float* x)
+    {
+        const __m512 zero = _mm512_setzero_ps();
+        for (int i = 0; i < n; i += 16) {
+            const __mmask16 lanes = (n - i >= 16) ? __mmask16(0xFFFF) : __mmask16((1u << (n - i)) - 1);
+            _mm512_mask_storeu_ps(x + i, lanes, _mm512_maskz_max_ps(lanes, _mm512_maskz_loadu_ps(lanes, x + i), zero));
+        }
+    }
+
+    SIMD_TARGET("avx512f")
+    void SigmoidAvx512(int n, float* x)
+    {
+        for (int i = 0; i < n; i += 16) {
+            const __mmask16 lanes = (n - i >= 16) ? __mmask16(0xFFFF) : __mmask16((1u << (n - i)) - 1);
+            _mm512_mask_storeu_ps(x + i, lanes, SigmoidAvx512(lanes, _mm512_maskz_loadu_ps(lanes, x + i)));
+        }
+    }
+
+    SIMD_TARGET("avx512f")
+    float ExpSumAvx512(int n, float shift, float* x)
+    {
+        const __m512 vShift = _mm512_set1_ps(shift);
+        __m512 sum = _mm512_setzero_ps();
+        for (int i = 0; i < n; i += 16) {
+            const __mmask16 lanes = (n - i >= 16) ? __mmask16(0xFFFF) : __mmask16((1u << (n - i)) - 1);
+            const __m512 e = _mm512_maskz_mov_ps(lanes, ExpAvx512(lanes, _mm512_sub_ps(_mm512_maskz_loadu_ps(lanes, x + i), vShift)));
+            _mm512_mask_storeu_ps(x + i, lanes, e);
+            sum = _mm512_add_ps(sum, e);
+        }
+        float lanes[16];
+        _mm512_storeu_ps(lanes, sum);
+        return SumScalar(16, lanes);
+    }
+
+    SIMD_TARGET("avx512f")
+    void SigmoidBackwardAvx512(int n, const float* dA, const float* out, float* dZ)
+    {
+        const __m512 one = _mm512_set1_ps(1);
+        for (int i = 0; i < n; i += 16) {
+            const __mmask16 lanes = (n - i >= 16) ? __mmask16(0xFFFF) : __mmask16((1u << (n - i)) - 1);
+            const __m512 sigmoid = SigmoidAvx512(lanes, _mm512_maskz_loadu_ps(lanes, out + i));
+            const __m512 grad = _mm512_mul_ps(_mm512_mul_ps(_mm512_maskz_loadu_ps(lanes, dA + i), sigmoid), _mm512_sub_ps(one, sigmoid));
+            _mm512_mask_storeu_ps(dZ + i, lanes, grad);
+        }
+    }
+
+    SIMD_TARGET("avx512f")
+    void BilinearAvx512(int n, const float* image, int stride, float maxX, float maxY,
+        const float* xs, const float* ys, float* out)
+    {
+        const __m512 zero = _mm512_setzero_ps();
+        const __m512 vMaxX = _mm512_set1_ps(maxX);
+        const __m512 vMaxY = _mm512_set1_ps(maxY);
+        const __m512i vStride = _mm512_set1_epi32(stride);
+        for (int i = 0; i < n; i += 16) {
+            // the tail runs masked; its inactive lanes gather nothing
+            const __mmask16 lanes = (n - i >= 16) ? __mmask16(0xFFFF) : __mmask16((1u << (n - i)) - 1);
+            // zero-masked forms throughout: the unmasked min, max and conversions trip
+            // -Wmaybe-uninitialized in GCC 12 headers
+            const __m512 x = _mm512_maskz_min_ps(lanes, _mm512_maskz_max_ps(lanes, _mm512_maskz_loadu_ps(lanes, xs + i), zero), vMaxX);
+            const __m512 y = _mm512_maskz_min_ps(lanes, _mm512_maskz_max_ps(lanes, _mm512_maskz_loadu_ps(lanes, ys + i), zero), vMaxY);
+            const __m512i x0 = _mm512_maskz_cvttps_epi32(lanes, x);
+            const __m512i y0 = _mm512_maskz_cvttps_epi32(lanes, y);
+            const __m512 fx = _mm512_sub_ps(x, _mm512_maskz_cvtepi32_ps(lanes, x0));
+            const __m512 fy = _mm512_sub_ps(y, _mm512_maskz_cvtepi32_ps(lanes, y0));
+            const __m512i offsets = _mm512_add_epi32(_mm512_mullo_epi32(y0, vStride), x0);
+            const __m512 a = _mm512_mask_i32gather_ps(zero, lanes, offsets, image, 4);
+            const __m512 b = _mm512_mask_i32gather_ps(zero, lanes, offsets, image + 1, 4);
+            const __m512 c = _mm512_mask_i32gather_ps(zero, lanes, offsets, image + stride, 4);
+            const __m512 d = _mm512_mask_i32gather_ps(zero, lanes, offsets, image + stride + 1, 4);
+            const __m512 top = _mm512_fmadd_ps(fx, _mm512_sub_ps(b, a), a);
+            const __m512 bottom = _mm512_fmadd_ps(fx, _mm512_sub_ps(d, c), c);
+            _mm512_mask_storeu_ps(out + i, lanes, _mm512_fmadd_ps(fy, _mm512_sub_ps(bottom, top), top));
+        }
+    }
+
+    const SimdKernels Sse2Kernels = { "sse2", GemmTileSse2, AxpySse2, HogwildAxpySse2, SumSse2,
+        ReluSse2, SigmoidSse2, ExpSumSse2, ReluBackwardSse2, SigmoidBackwardSse2, BilinearSse2 };
+    const SimdKernels Avx2Kernels = { "avx2", GemmTileAvx2, AxpyAvx2, HogwildAxpyAvx2, SumAvx2,
+        ReluAvx2, SigmoidAvx2, ExpSumAvx2, ReluBackwardAvx2, SigmoidBackwardAvx2, BilinearAvx2 };
+    const SimdKernels Avx512Kernels = { "avx512", GemmTileAvx512, AxpyAvx512, HogwildAxpyAvx512, SumAvx512,
+        ReluAvx512, SigmoidAvx512, ExpSumAvx512, ReluBackwardAvx512, SigmoidBackwardAvx512, BilinearAvx512 };
+
+    // Register state the OS saves on context switches (XCR0)
+    unsigned long long EnabledStateMask()
+    {
+#ifdef _MSC_VER
+        return _xgetbv(0);
+#else
+        unsigned lo, hi;
+        __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+        return (static_cast<unsigned long long>(hi) << 32) | lo;
+#endif
+    }
+#endif
+
+    std::vector<const SimdKernels*> DetectKernels()
+    {
+        std::vector<const SimdKernels*> kernels = { &ScalarKernels };
+#ifdef MNIST_CNN_SIMD_X86
+        unsigned regs[4];
+        Cpuid(0, 0, regs);
+        const unsigned maxLeaf = regs[0];
+        Cpuid(1, 0, regs);
+        const unsigned ecx1 = regs[2];
+        const unsigned edx1 = regs[3];
+        if (!(edx1 & (1u << 26))) {
+            return kernels;
+        }
+        kernels.push_back(&Sse2Kernels);
+
+        const bool osxsave = (ecx1 & (1u << 27)) != 0;
+        const bool avx = (ecx1 & (1u << 28)) != 0;
+        const bool fma = (ecx1 & (1u << 12)) != 0;
+        if (maxLeaf < 7 || !osxsave || !avx || !fma) {
+            return kernels;
+        }
+        const unsigned long long xcr0 = EnabledStateMask();
+        Cpuid(7, 0, regs);
+        const unsigned ebx7 = regs[1];
+
+        // XMM and YMM state
+        if ((ebx7 & (1u << 5)) && (xcr0 & 0x6) == 0x6) {
+            kernels.push_back(&Avx2Kernels);
+            // opmask and both halves of ZMM state
+            if ((ebx7 & (1u << 16)) && (xcr0 & 0xE6) == 0xE6) {
+                kernels.push_back(&Avx512Kernels);
+            }
+        }
+#endif
+        return kernels;
+    }
+
+    const SimdKernels* SelectKernels()
+    {
+        const std::vector<const SimdKernels*> kernels = SupportedSimdKernels();
+        const char* forced = std::getenv("MNIST_CNN_SIMD");
+        if (forced) {
+            for (const SimdKernels* k : kernels) {
+                if (std::strcmp(k->name, forced) == 0) {
+                    return k;
+                }
+            }
+            std::cerr << "MNIST_CNN_SIMD=" << forced << " is not supported here, using " << kernels.back()->name << std::endl;
+        }
+        return kernels.back();
+    }
+
+    bool Close(Scalar expected, Scalar actual, Scalar tolerance)
+    {
+        return std::abs(expected - actual) <= tolerance * std::max<Scalar>(1, std::abs(expected));
+    }
+}
+
+const SimdKernels& Simd()
+{
+    static const SimdKernels* selected = SelectKernels();
+    return *selected;
+}
+
+std::vector<const SimdKernels*> SupportedSimdKernels()
+{
+    static const std::vector<const SimdKernels*> supported = DetectKernels();
+    return supported;
+}
+
+std::string CpuModel()
+{
+    std::string model = "unknown";
+#ifdef MNIST_CNN_X86
+    unsigned regs[4];
+    Cpuid(0x80000000, 0, regs);
+    if (regs[0] >= 0x80000004) {
+        // 48 bytes of brand string in the registers of three leaves, padded with NULs
+        char brand[49] = {};
+        for (int leaf = 0; leaf < 3; ++leaf) {
+            Cpuid(0x80000002 + leaf, 0, regs);
+            std::memcpy(brand + leaf * 16, regs, 16);
+        }
+        model = brand;
+        model.erase(0, model.find_first_not_of(' '));
+        model.erase(model.find_last_not_of(' ') + 1);
+        if (model.empty()) {
+            model = "unknown";
+        }
+    }
+#endif
+    return model;
+}
+
+bool SimdSelfTest(std::ostream& log)
+{
+    const Scalar tolerance = Scalar(1e-4);
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<Scalar> dist(-1, 1);
+    auto random = [&](int n) {
+        std::vector<Scalar> v(n);
+        for (Scalar& x : v) {
+            x = dist(gen);
+        }
+        return v;
+    };
+
+    // odd sizes exercise the remainder loops and masked tails
+    const int kc = 37;
+    const int n = 1000 + 13;
+    const std::vector<Scalar> a = random(kc * MR);
+    const std::vector<Scalar> b = random(kc * NR);
+    const std::vector<Scalar> x = random(n);
+    const std::vector<Scalar> y = random(n);
+    const Scalar alpha = Scalar(-0.37);
+    // activation inputs across the range where e^x neither vanishes nor overflows
+    std::vector<Scalar> wide(x);
+    for (Scalar& v : wide) {
+        v *= 20;
+    }
+    const Scalar shift = Scalar(3.5);
+    // gradients with whole zero groups and scattered zeros, as dead units leave them
+    std::vector<Scalar> sparse(x);
+    for (int i = 0; i < n; ++i) {
+        if ((i / 24) % 3 == 0 || i % 5 == 0) {
+            sparse[i] = 0;
+        }
+    }
+    // sample points around and beyond a 16 x 16 image, with one padding column and row
+    const int side = 16;
+    const std::vector<Scalar> image = random((side + 1) * (side + 1));
+    std::vector<Scalar> xs = random(n);
+    std::vector<Scalar> ys = random(n);
+    for (int i = 0; i < n; ++i) {
+        xs[i] = (xs[i] + 1) * (side + 2) / 2 - 1;
+        ys[i] = (ys[i] + 1) * (side + 2) / 2 - 1;
+    }
+
+    std::vector<Scalar> refTile(MR * NR);
+    std::vector<Scalar> refAxpy(y);
+    std::vector<Scalar> refHogwild(y);
+    std::vector<Scalar> refRelu(wide);
+    std::vector<Scalar> refSigmoid(wide);
+    std::vector<Scalar> refExp(wide);
+    std::vector<Scalar> refReluBackward(n);
+    std::vector<Scalar> refSigmoidBackward(n);
+    std::vector<Scalar> refBilinear(n);
+    ScalarKernels.gemmTile(kc, a.data(), b.data(), refTile.data());
+    ScalarKernels.axpy(n, alpha, x.data(), refAxpy.data());
+    ScalarKernels.hogwildAxpy(n, alpha, sparse.data(), refHogwild.data());
+    ScalarKernels.relu(n, refRelu.data());
+    ScalarKernels.sigmoid(n, refSigmoid.data());
+    const Scalar refExpSum = ScalarKernels.expSum(n, shift, refExp.data());
+    ScalarKernels.reluBackward(n, x.data(), y.data(), refReluBackward.data());
+    ScalarKernels.sigmoidBackward(n, x.data(), wide.data(), refSigmoidBackward.data());
+    ScalarKernels.bilinear(n, image.data(), side + 1, Scalar(side - 1), Scalar(side - 1), xs.data(), ys.data(), refBilinear.data());
+    const Scalar refSum = ScalarKernels.sum(n, x.data());
+
+    bool allPassed = true;
+    for (const SimdKernels* kernels : SupportedSimdKernels()) {
+        std::vector<Scalar> tile(MR * NR);
+        std::vector<Scalar> axpy(y);
+        std::vector<Scalar> hogwild(y);
+        std::vector<Scalar> relu(wide);
+        std::vector<Scalar> sigmoid(wide);
+        std::vector<Scalar> exps(wide);
+        std::vector<Scalar> reluBackward(n);
+        std::vector<Scalar> sigmoidBackward(n);
+        std::vector<Scalar> bilinear(n);
+        kernels->gemmTile(kc, a.data(), b.data(), tile.data());
+        kernels->axpy(n, alpha, x.data(), axpy.data());
+        kernels->hogwildAxpy(n, alpha, sparse.data(), hogwild.data());
+        kernels->relu(n, relu.data());
+        kernels->sigmoid(n, sigmoid.data());
+        const Scalar expSum = kernels->expSum(n, shift, exps.data());
+        kernels->reluBackward(n, x.data(), y.data(), reluBackward.data());
+        kernels->sigmoidBackward(n, x.data(), wide.data(), sigmoidBackward.data());
+        kernels->bilinear(n, image.data(), side + 1, Scalar(side - 1), Scalar(side - 1), xs.data(), ys.data(), bilinear.data());
+        const Scalar sum = kernels->sum(n, x.data());
+
+        bool passed = true;
+        for (int i = 0; i < MR * NR; ++i) {
+            passed &= Close(refTile[i], tile[i], tolerance);
+        }
+        for (int i = 0; i < n; ++i) {
+            passed &= Close(refAxpy[i], axpy[i], tolerance);
+            passed &= Close(refHogwild[i], hogwild[i], tolerance) && (sparse[i] != 0 || hogwild[i] == y[i]);
+            passed &= refRelu[i] == relu[i];
+            passed &= Close(refSigmoid[i], sigmoid[i], tolerance);
+            passed &= Close(refExp[i], exps[i], tolerance);
+            passed &= refReluBackward[i] == reluBackward[i];
+            passed &= Close(refSigmoidBackward[i], sigmoidBackward[i], tolerance);
+            passed &= Close(refBilinear[i], bilinear[i], tolerance);
+        }
+        passed &= Close(refSum, sum, tolerance);
+        passed &= Close(refExpSum, expSum, tolerance);
+
+        log << "simd " << kernels->name << ": " << (passed ? "ok" : "MISMATCH")
+            << (kernels == &Simd() ? " (selected)" : "") << std::endl;
+        allPassed &= passed;
+    }
+    return allPassed;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include "Scalar.h"
+
+// One implementation of the hot loops for a given instruction set. All variants compute
+// the same results up to floating-point reassociation.
+struct SimdKernels {
+    // register tile of gemmTile, the GEMM packs its panels in slivers of this size
+    static const int MR = 4;
+    static const int NR = 16;
+
+    const char* name;
+    // acc (MR x NR, row-major) = sum over kc of a column of packed A times a row of packed B
+    void (*gemmTile)(int kc, const Scalar* a, const Scalar* b, Scalar* acc);
+    // y += alpha * x
+    void (*axpy)(int n, Scalar alpha, const Scalar* x, Scalar* y);
+    // y += alpha * x for Hogwild! training, where y are parameters other threads read and
+    // update at the same time without synchronisation; this is the one place those writes
+    // happen. Every element of y is loaded and stored at most once, with plain accesses of
+    // at most the vector width that x86 and ARM do not tear within an aligned element, so a
+    // reader sees the old or the new value and a concurrent update may be lost, which
+    // Hogwild! tolerates. Groups of elements whose x is all zero are not stored to at all,
+    // so parameters without gradient keep their cache lines shared between the cores.
+    void (*hogwildAxpy)(int n, Scalar alpha, const Scalar* x, Scalar* y);
+    Scalar (*sum)(int n, const Scalar* x);
+    // Activations in place, x = max(x, 0) and x = 1 / (1 + e^-x). The vector variants
+    // evaluate e^x with a polynomial good to a few ulps, clamping x to [-87, 88] first.
+    void (*relu)(int n, Scalar* x);
+    void (*sigmoid)(int n, Scalar* x);
+    // x = e^(x - shift) in place, returns the sum of the results
+    Scalar (*expSum)(int n, Scalar shift, Scalar* x);
+    // dZ = dA where the ReLU output is positive, 0 elsewhere
+    void (*reluBackward)(int n, const Scalar* dA, const Scalar* out, Scalar* dZ);
+    // dZ = dA * SigmoidDeriv(out), the derivative the layers have always taken at their output
+    void (*sigmoidBackward)(int n, const Scalar* dA, const Scalar* out, Scalar* dZ);
+    // out[i] = image sampled at column xs[i], row ys[i] with bilinear interpolation, the
+    // coordinates clamped to [0, maxX] x [0, maxY] first. The image must hold the pixels
+    // one column and one row past the clamp range.
+    void (*bilinear)(int n, const Scalar* image, int stride, Scalar maxX, Scalar maxY,
+        const Scalar* xs, const Scalar* ys, Scalar* out);
+};
+
+// Kernels picked once by CPUID: the widest of AVX-512, AVX2+FMA, SSE2 and the portable
+// scalar code the CPU and OS support. MNIST_CNN_SIMD=scalar|sse2|avx2|avx512 forces a
+// narrower variant. The vector variants exist for float only, double builds stay scalar.
+const SimdKernels& Simd();
+// Every variant this CPU can run, scalar first
+std::vector<const SimdKernels*> SupportedSimdKernels();
+// CPUID brand string, "unknown" where there is none
+std::string CpuModel();
+// Checks every supported variant against the scalar reference, logs the result per variant
+bool SimdSelfTest(std::ostream& log);
@@ -1,12 +1,13 @@
 #include "Tensor.h"
 #include <cassert>
 
-Tensor::Tensor(int height, int width, int depth)
+Tensor::Tensor(int height, int width, int depth, int batch)
 {
     size.height = height;
     size.width = width;
     size.depth = depth;
-    values.resize(height * width * depth);
+    size.batch = batch;
+    values.resize(height * width * depth * batch);
     hw = height * width;
 }
 
@@ -43,32 +44,19 @@ Tensor::Tensor(const Mat3& mat)
     }
 }
 
-Tensor Tensor::turn180()
-{
-    Tensor turned(size);
-    for (int d = 0; d < size.depth; ++d) {
-        for (int i = size.height - 1; i >= 0; --i) {
-            for (int j = size.width - 1; j >= 0; --j) {
-                turned(size.height - i - 1, size.width - j -1, d) = (*this)(i, j, d);
-            }
-        }
-    }
-    return turned;
-}
-
-void Tensor::set(const Mat2& mat, int d)
+void Tensor::set(const Mat2& mat, int d, int n)
 {
     assert(mat.size() == size.height);
     assert(mat[0].size() == size.width);
 
     for (int i = 0; i < mat.size(); ++i) {
         for (int j = 0; j < mat[0].size(); ++j) {
-            operator()(i, j, d) = mat[i][j];
+            operator()(i, j, d, n) = mat[i][j];
         }
     }
 }
 
-void Tensor::set(const Tensor& tensor, int d)
+void Tensor::set(const TensorView& tensor, int d)
 {
     assert(tensor.depth() == 1);
     assert(tensor.height() == size.height);
@@ -93,25 +81,30 @@ void Tensor::copy(const Tensor& toCopy, int from_depth, int to_depth)
     }
 }
 
-double& Tensor::operator()(int i, int j, int d)
+void Tensor::setBatch(int batch)
+{
+    size.batch = batch;
+    values.resize(batch * size.depth * hw);
+}
+
+Scalar& Tensor::operator()(int i, int j, int d)
 {
     return values[d * hw + i * size.width + j];
 }
 
-double Tensor::operator()(int i, int j, int d) const
+Scalar Tensor::operator()(int i, int j, int d) const
 {
     return values[d * hw + i * size.width + j];
 }
 
-Tensor Tensor::operator()(int d)
+Scalar& Tensor::operator()(int i, int j, int d, int n)
 {
-    Tensor res(size.height, size.width, 1);
-    for (int i = 0; i < size.height; ++i) {
-        for (int j = 0; j < size.width; ++j) {
-            res(i, j, 0) = (*this)(i, j, d);
-        }
-    }
-    return res;
+    return values[(n * size.depth + d) * hw + i * size.width + j];
+}
+
+Scalar Tensor::operator()(int i, int j, int d, int n) const
+{
+    return values[(n * size.depth + d) * hw + i * size.width + j];
 }
 
 Tensor Tensor::operator+(const Mat& mat)
@@ -128,7 +121,7 @@ Tensor Tensor::operator+(const Mat& mat)
     return res;
 }
 
-Tensor Tensor::operator+(double num)
+Tensor Tensor::operator+(Scalar num)
 {
     Tensor res(*this);
     for (int d = 0; d < size.depth; ++d) {
@@ -156,26 +149,78 @@ void Tensor::operator+=(const Tensor& other)
     }
 }
 
-double& Tensor::operator[](int index)
+Scalar& Tensor::operator[](int index)
 {
     return values[index];
 }
 
-const double& Tensor::operator[](int index) const
+const Scalar& Tensor::operator[](int index) const
 {
     return values[index];
 }
 
 std::ostream& operator<<(std::ostream& out, const Tensor& t)
 {
-    for (int d = 0; d < t.size.depth; ++d) {
-        for (int i = 0; i < t.size.height; ++i) {
-            for (int j = 0; j < t.size.width; ++j) {
-                out << t(i, j, d) << " ";
+    for (int n = 0; n < t.size.batch; ++n) {
+        for (int d = 0; d < t.size.depth; ++d) {
+            for (int i = 0; i < t.size.height; ++i) {
+                for (int j = 0; j < t.size.width; ++j) {
+                    out << t(i, j, d, n) << " ";
+                }
+                out << std::endl;
             }
             out << std::endl;
         }
-        out << std::endl;
     }
     return out;
 }
+
+TensorView::TensorView(const Scalar* data, const Tensor::Size& size) :
+    base(data),
+    size(size),
+    colStride(1),
+    rowStride(size.width),
+    channelStride(size.height * size.width),
+    sampleStride(size.depth * size.height * size.width)
+{
+}
+
+TensorView TensorView::channel(int d) const
+{
+    assert(d >= 0 && d < size.depth);
+    TensorView view(*this);
+    view.base += d * channelStride;
+    view.size.depth = 1;
+    return view;
+}
+
+TensorView TensorView::sample(int n) const
+{
+    assert(n >= 0 && n < size.batch);
+    TensorView view(*this);
+    view.base += n * sampleStride;
+    view.size.batch = 1;
+    return view;
+}
+
+TensorView TensorView::rotated180() const
+{
+    // (i, j) of the rotation is (height - 1 - i, width - 1 - j) of this view
+    TensorView view(*this);
+    view.base += (size.height - 1) * rowStride + (size.width - 1) * colStride;
+    view.rowStride = -rowStride;
+    view.colStride = -colStride;
+    return view;
+}
+
+bool TensorView::isContiguous() const
+{
+    return colStride == 1 && rowStride == size.width && channelStride == size.height * size.width
+        && (size.batch == 1 || sampleStride == size.depth * channelStride);
+}
+
+const Scalar* TensorView::data(int n) const
+{
+    assert(isContiguous());
+    return base + n * sampleStride;
+}
@@ -1,10 +1,16 @@
 #pragma once
 #include <vector>
 #include <iostream>
+#include "Scalar.h"
+#include "AlignedAllocator.h"
 
-typedef std::vector<double> Mat;
-typedef std::vector<std::vector<double>> Mat2;
-typedef std::vector<std::vector<std::vector<double>>> Mat3;
+typedef std::vector<Scalar> Mat;
+typedef std::vector<std::vector<Scalar>> Mat2;
+typedef std::vector<std::vector<std::vector<Scalar>>> Mat3;
+// cache-line aligned storage for buffers the GEMM kernels stream through
+typedef std::vector<Scalar, AlignedAllocator<Scalar>> AlignedMat;
+
+class TensorView;
 
 class Tensor
 {
@@ -13,39 +19,78 @@ public:
         int height;
         int width;
         int depth;
+        int batch = 1;
     };
 public:
     friend std::ostream& operator<<(std::ostream& out, const Tensor& t);
 
     Tensor() : Tensor(0,0,0) {}
-    Tensor(int height, int width, int depth);
-    Tensor(const Tensor::Size& size) : Tensor(size.height, size.width, size.depth) {}
+    Tensor(int height, int width, int depth, int batch = 1);
+    Tensor(const Tensor::Size& size) : Tensor(size.height, size.width, size.depth, size.batch) {}
     Tensor(const Mat2& mat);
     Tensor(const Mat3& mat);
 
-    Tensor turn180();
-    void set(const Mat2& mat, int d);
-    void set(const Tensor& tensor, int d);
+    void set(const Mat2& mat, int d, int n = 0);
+    void set(const TensorView& tensor, int d);
     void copy(const Tensor& toCopy, int from_depth, int to_depth);
+    void setBatch(int batch);
     Mat flatten() { return values; }
 
-    double& operator()(int i, int j, int d);
-    double operator()(int i, int j, int d) const;
-    Tensor operator()(int d);
+    Scalar& operator()(int i, int j, int d);
+    Scalar operator()(int i, int j, int d) const;
+    Scalar& operator()(int i, int j, int d, int n);
+    Scalar operator()(int i, int j, int d, int n) const;
     Tensor operator+(const Mat& mat);
-    Tensor operator+(double num);
+    Tensor operator+(Scalar num);
     void operator+=(const Tensor& other);
-    double& operator[](int index);
-    const double& operator[](int index) const;
+    Scalar& operator[](int index);
+    const Scalar& operator[](int index) const;
 
     int depth() const { return size.depth; }
     int height() const { return size.height; }
     int width() const { return size.width; }
+    int batch() const { return size.batch; }
+    int sampleSize() const { return size.depth * hw; }
     Tensor::Size getSize() const { return size; }
     int getRawSize() const { return values.size(); }
+    Scalar* data(int n = 0) { return values.data() + n * size.depth * hw; }
+    const Scalar* data(int n = 0) const { return values.data() + n * size.depth * hw; }
 private:
     Size size;
     Mat values;
     int hw;
 };
 
+// Non-owning, read-only window on NCHW data with per-dimension strides: a whole Tensor,
+// one channel or sample of it, a flat buffer read as a tensor, or a 180 degree rotation
+// (negative row and column strides). Views are invalidated when the storage is resized.
+class TensorView
+{
+public:
+    TensorView() {}
+    TensorView(const Scalar* data, const Tensor::Size& size);
+    TensorView(const Tensor& tensor) : TensorView(tensor.data(), tensor.getSize()) {}
+
+    TensorView channel(int d) const;
+    TensorView sample(int n) const;
+    TensorView rotated180() const;
+
+    Scalar operator()(int i, int j, int d) const { return base[d * channelStride + i * rowStride + j * colStride]; }
+    Scalar operator()(int i, int j, int d, int n) const { return base[n * sampleStride + d * channelStride + i * rowStride + j * colStride]; }
+
+    int depth() const { return size.depth; }
+    int height() const { return size.height; }
+    int width() const { return size.width; }
+    int batch() const { return size.batch; }
+    Tensor::Size getSize() const { return size; }
+    // true when the view is plain NCHW storage, so data() can be handed to the raw kernels
+    bool isContiguous() const;
+    const Scalar* data(int n = 0) const;
+private:
+    const Scalar* base = nullptr;
+    Tensor::Size size = { 0, 0, 0, 0 };
+    int colStride = 0;
+    int rowStride = 0;
+    int channelStride = 0;
+    int sampleStride = 0;
+};
@@ -0,0 +1,93 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(int threads)
+{
+    for (int i = 1; i < threads; ++i) {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::run(int count, TaskFunc func, const void* context)
+{
+    if (count <= 0) {
+        return;
+    }
+    if (workers.empty() || count == 1) {
+        for (int i = 0; i < count; ++i) {
+            func(context, i);
+        }
+        return;
+    }
+
+    unsigned long long gen;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->func = func;
+        this->context = context;
+        this->count = count;
+        next = 0;
+        remaining = count;
+        gen = ++generation;
+    }
+    wake.notify_all();
+
+    runTasks(gen);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return remaining == 0; });
+    this->func = nullptr;
+    this->context = nullptr;
+}
+
+void ThreadPool::workerLoop()
+{
+    unsigned long long seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stop || generation != seen; });
+            if (stop) {
+                return;
+            }
+            seen = generation;
+        }
+        runTasks(seen);
+    }
+}
+
+void ThreadPool::runTasks(unsigned long long gen)
+{
+    for (;;) {
+        int i;
+        TaskFunc job;
+        const void* jobContext;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (gen != generation || next >= count) {
+                return;
+            }
+            i = next++;
+            job = func;
+            jobContext = context;
+        }
+
+        job(jobContext, i);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--remaining == 0) {
+            done.notify_all();
+        }
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+    // threads counts the calling thread, which takes part in every parallelFor
+    explicit ThreadPool(int threads);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    void operator=(const ThreadPool&) = delete;
+
+    // Runs task(0) ... task(count - 1) on the pool and returns once all of them finished.
+    // The task is only referenced, never copied, so no std::function allocation per call.
+    template <typename Task>
+    void parallelFor(int count, const Task& task)
+    {
+        run(count, [](const void* context, int i) { (*static_cast<const Task*>(context))(i); }, &task);
+    }
+    int size() const { return workers.size() + 1; }
+private:
+    typedef void (*TaskFunc)(const void* context, int i);
+
+    void run(int count, TaskFunc func, const void* context);
+    void workerLoop();
+    void runTasks(unsigned long long gen);
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    TaskFunc func = nullptr;
+    const void* context = nullptr;
+    int count = 0;
+    int next = 0;
+    int remaining = 0;
+    unsigned long long generation = 0;
+    bool stop = false;
+};
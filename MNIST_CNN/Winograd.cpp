@@ -0,0 +1,278 @@
+#include "Winograd.h"
+#include "Gemm.h"
+#include "Math.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <random>
+
+struct Winograd::Transform {
+    int m;
+    int r;
+    int alpha;
+    // alpha x alpha input transform, alpha x r kernel transform, m x alpha output transform
+    const Scalar* BT;
+    const Scalar* G;
+    const Scalar* AT;
+};
+
+namespace {
+    // Interpolation points 0, 1, -1 (, 2, -2) and infinity, as in Lavin & Gray
+    const Scalar BT_F2x3[] = {
+        1, 0, -1, 0,
+        0, 1, 1, 0,
+        0, -1, 1, 0,
+        0, 1, 0, -1,
+    };
+    const Scalar G_F2x3[] = {
+        1, 0, 0,
+        1.0 / 2, 1.0 / 2, 1.0 / 2,
+        1.0 / 2, -1.0 / 2, 1.0 / 2,
+        0, 0, 1,
+    };
+    const Scalar AT_F2x3[] = {
+        1, 1, 1, 0,
+        0, 1, -1, -1,
+    };
+
+    // shared by F(4x4, 3x3) and F(2x2, 5x5), both have 6 x 6 input tiles
+    const Scalar BT_Alpha6[] = {
+        4, 0, -5, 0, 1, 0,
+        0, -4, -4, 1, 1, 0,
+        0, 4, -4, -1, 1, 0,
+        0, -2, -1, 2, 1, 0,
+        0, 2, -1, -2, 1, 0,
+        0, 4, 0, -5, 0, 1,
+    };
+    const Scalar G_F4x3[] = {
+        1.0 / 4, 0, 0,
+        -1.0 / 6, -1.0 / 6, -1.0 / 6,
+        -1.0 / 6, 1.0 / 6, -1.0 / 6,
+        1.0 / 24, 1.0 / 12, 1.0 / 6,
+        1.0 / 24, -1.0 / 12, 1.0 / 6,
+        0, 0, 1,
+    };
+    const Scalar AT_F4x3[] = {
+        1, 1, 1, 1, 1, 0,
+        0, 1, -1, 2, -2, 0,
+        0, 1, 1, 4, 4, 0,
+        0, 1, -1, 8, -8, 1,
+    };
+    const Scalar G_F2x5[] = {
+        1.0 / 4, 0, 0, 0, 0,
+        -1.0 / 6, -1.0 / 6, -1.0 / 6, -1.0 / 6, -1.0 / 6,
+        -1.0 / 6, 1.0 / 6, -1.0 / 6, 1.0 / 6, -1.0 / 6,
+        1.0 / 24, 1.0 / 12, 1.0 / 6, 1.0 / 3, 2.0 / 3,
+        1.0 / 24, -1.0 / 12, 1.0 / 6, -1.0 / 3, 2.0 / 3,
+        0, 0, 0, 0, 1,
+    };
+    const Scalar AT_F2x5[] = {
+        1, 1, 1, 1, 1, 0,
+        0, 1, -1, 2, -2, 1,
+    };
+
+    const int MAX_ALPHA = 6;
+
+    // Y (p x p) = L (p x q) * X (q x q) * L^T
+    void Sandwich(const Scalar* L, int p, int q, const Scalar* X, Scalar* Y)
+    {
+        Scalar tmp[MAX_ALPHA * MAX_ALPHA];
+        for (int i = 0; i < p; ++i) {
+            for (int j = 0; j < q; ++j) {
+                Scalar sum = 0;
+                for (int k = 0; k < q; ++k) {
+                    sum += L[i * q + k] * X[k * q + j];
+                }
+                tmp[i * q + j] = sum;
+            }
+        }
+        for (int i = 0; i < p; ++i) {
+            for (int j = 0; j < p; ++j) {
+                Scalar sum = 0;
+                for (int k = 0; k < q; ++k) {
+                    sum += tmp[i * q + k] * L[j * q + k];
+                }
+                Y[i * p + j] = sum;
+            }
+        }
+    }
+}
+
+Winograd::Winograd(const Tensor::Size& inputSize, int kernel_num, int kernel_dim, int padding, int tile) :
+    inputSize(inputSize),
+    kernel_num(kernel_num),
+    padding(padding)
+{
+    static const Transform F2x3 = { 2, 3, 4, BT_F2x3, G_F2x3, AT_F2x3 };
+    static const Transform F4x3 = { 4, 3, 6, BT_Alpha6, G_F4x3, AT_F4x3 };
+    static const Transform F2x5 = { 2, 5, 6, BT_Alpha6, G_F2x5, AT_F2x5 };
+
+    assert(supports(kernel_dim, 1));
+    if (kernel_dim == 3) {
+        transform = (tile == 2) ? &F2x3 : &F4x3;
+    }
+    else {
+        transform = &F2x5;
+    }
+    assert(tile == 0 || tile == transform->m);
+
+    outputSize.depth = kernel_num;
+    outputSize.height = inputSize.height + 2 * padding - kernel_dim + 1;
+    outputSize.width = inputSize.width + 2 * padding - kernel_dim + 1;
+    tilesY = (outputSize.height + transform->m - 1) / transform->m;
+    tilesX = (outputSize.width + transform->m - 1) / transform->m;
+
+    const int positions = transform->alpha * transform->alpha;
+    const int tiles = tilesY * tilesX;
+    U.resize(positions * kernel_num * inputSize.depth);
+    V.resize(positions * inputSize.depth * tiles);
+    M.resize(positions * kernel_num * tiles);
+}
+
+bool Winograd::supports(int kernel_dim, int stride)
+{
+    return stride == 1 && (kernel_dim == 3 || kernel_dim == 5);
+}
+
+void Winograd::transformKernels(const Scalar* kernels)
+{
+    const int r = transform->r;
+    const int depth = inputSize.depth;
+    const int positions = transform->alpha * transform->alpha;
+
+    Scalar u[MAX_ALPHA * MAX_ALPHA];
+    for (int k = 0; k < kernel_num; ++k) {
+        for (int c = 0; c < depth; ++c) {
+            Sandwich(transform->G, transform->alpha, r, kernels + (k * depth + c) * r * r, u);
+            for (int xi = 0; xi < positions; ++xi) {
+                U[(xi * kernel_num + k) * depth + c] = u[xi];
+            }
+        }
+    }
+}
+
+void Winograd::forward(const Scalar* img, const Scalar* bias, void (*activation)(int n, Scalar* x), Scalar* out)
+{
+    const int m = transform->m;
+    const int alpha = transform->alpha;
+    const int positions = alpha * alpha;
+    const int depth = inputSize.depth;
+    const int tiles = tilesY * tilesX;
+
+    // input tiles overlap by r - 1 rows and columns; positions outside the image are padding
+    Scalar d[MAX_ALPHA * MAX_ALPHA];
+    Scalar v[MAX_ALPHA * MAX_ALPHA];
+    for (int c = 0; c < depth; ++c) {
+        const Scalar* channel = img + c * inputSize.height * inputSize.width;
+        for (int ty = 0; ty < tilesY; ++ty) {
+            for (int tx = 0; tx < tilesX; ++tx) {
+                const int y0 = ty * m - padding;
+                const int x0 = tx * m - padding;
+                for (int i = 0; i < alpha; ++i) {
+                    for (int j = 0; j < alpha; ++j) {
+                        const int y = y0 + i;
+                        const int x = x0 + j;
+                        const bool inside = y >= 0 && y < inputSize.height && x >= 0 && x < inputSize.width;
+                        d[i * alpha + j] = inside ? channel[y * inputSize.width + x] : 0;
+                    }
+                }
+                Sandwich(transform->BT, alpha, alpha, d, v);
+
+                const int t = ty * tilesX + tx;
+                for (int xi = 0; xi < positions; ++xi) {
+                    V[(xi * depth + c) * tiles + t] = v[xi];
+                }
+            }
+        }
+    }
+
+    for (int xi = 0; xi < positions; ++xi) {
+        Gemm(false, false, kernel_num, tiles, depth, 1, U.data() + xi * kernel_num * depth, depth,
+            V.data() + xi * depth * tiles, tiles, 0, M.data() + xi * kernel_num * tiles, tiles);
+    }
+
+    Scalar mm[MAX_ALPHA * MAX_ALPHA];
+    Scalar y[MAX_ALPHA * MAX_ALPHA];
+    for (int k = 0; k < kernel_num; ++k) {
+        Scalar* plane = out + k * outputSize.height * outputSize.width;
+        for (int ty = 0; ty < tilesY; ++ty) {
+            for (int tx = 0; tx < tilesX; ++tx) {
+                const int t = ty * tilesX + tx;
+                for (int xi = 0; xi < positions; ++xi) {
+                    mm[xi] = M[(xi * kernel_num + k) * tiles + t];
+                }
+                Sandwich(transform->AT, m, alpha, mm, y);
+
+                // the last row and column of tiles may hang over the output
+                const int rows = std::min(m, outputSize.height - ty * m);
+                const int cols = std::min(m, outputSize.width - tx * m);
+                for (int i = 0; i < rows; ++i) {
+                    Scalar* row = plane + (ty * m + i) * outputSize.width + tx * m;
+                    for (int j = 0; j < cols; ++j) {
+                        row[j] = y[i * m + j] + bias[k];
+                    }
+                }
+            }
+        }
+        // over the whole plane, the rows of a tile are too short to fill a vector
+        if (activation) {
+            activation(outputSize.height * outputSize.width, plane);
+        }
+    }
+}
+
+bool WinogradSelfTest(std::ostream& log)
+{
+    // float accumulates a few ulps per transform stage, the larger tiles amplify them most
+    const double tolerance = std::numeric_limits<Scalar>::epsilon() * 1000;
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<Scalar> dist(-1, 1);
+
+    const int variants[][2] = { { 3, 2 }, { 3, 4 }, { 5, 2 } };
+    bool allPassed = true;
+    for (const auto& variant : variants) {
+        const int kernel_dim = variant[0];
+        const int tile = variant[1];
+        for (int padding = 0; padding <= 1; ++padding) {
+            // odd sizes leave partial tiles at the bottom and right edges
+            const Tensor::Size size = { 11, 13, 3 };
+            const int kernel_num = 4;
+            const int patch = size.depth * kernel_dim * kernel_dim;
+
+            Mat img(size.height * size.width * size.depth);
+            Mat kernels(kernel_num * patch);
+            const Mat bias(kernel_num, 0);
+            for (Scalar& x : img) {
+                x = dist(gen);
+            }
+            for (Scalar& x : kernels) {
+                x = dist(gen);
+            }
+
+            Winograd winograd(size, kernel_num, kernel_dim, padding, tile);
+            winograd.transformKernels(kernels.data());
+            const int outHeight = size.height + 2 * padding - kernel_dim + 1;
+            const int outWidth = size.width + 2 * padding - kernel_dim + 1;
+            Mat out(kernel_num * outHeight * outWidth);
+            winograd.forward(img.data(), bias.data(), nullptr, out.data());
+
+            double maxError = 0;
+            double maxValue = 0;
+            for (int k = 0; k < kernel_num; ++k) {
+                const Tensor::Size kernelSize = { kernel_dim, kernel_dim, size.depth };
+                const Tensor ref = Conv(TensorView(img.data(), size), TensorView(kernels.data() + k * patch, kernelSize), 1, padding);
+                for (int i = 0; i < outHeight * outWidth; ++i) {
+                    maxError = std::max<double>(maxError, std::abs(ref[i] - out[k * outHeight * outWidth + i]));
+                    maxValue = std::max<double>(maxValue, std::abs(ref[i]));
+                }
+            }
+
+            const bool passed = maxError <= tolerance * std::max(1.0, maxValue);
+            log << "winograd F(" << tile << "x" << tile << ", " << kernel_dim << "x" << kernel_dim << ") padding " << padding
+                << ": max error " << maxError << (passed ? " ok" : " MISMATCH") << std::endl;
+            allPassed &= passed;
+        }
+    }
+    return allPassed;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "Tensor.h"
+#include <iostream>
+
+// Stride-1 convolution by Winograd minimal filtering F(m x m, r x r): every m x m output
+// tile comes from an alpha x alpha input tile (alpha = m + r - 1) with alpha^2 instead of
+// m^2 * r^2 multiplies per channel pair. The channel sums of the alpha^2 transformed
+// positions run as GEMMs of the transformed kernels and input tiles.
+class Winograd
+{
+public:
+    Winograd() {}
+    // tile is the output tile size m; 0 picks F(4x4, 3x3) for 3x3 kernels and F(2x2, 5x5) for 5x5
+    Winograd(const Tensor::Size& inputSize, int kernel_num, int kernel_dim, int padding, int tile = 0);
+
+    static bool supports(int kernel_dim, int stride);
+
+    // Kernels are kernel_num x (depth * kernel_dim * kernel_dim), as Conv2d stores them.
+    // The transformed copy is what forward() uses, so call it again after every update.
+    void transformKernels(const Scalar* kernels);
+    // One sample: out (kernel_num x out height x out width) = activation(conv(img) + bias)
+    // activation is one of the Simd() activations or null
+    void forward(const Scalar* img, const Scalar* bias, void (*activation)(int n, Scalar* x), Scalar* out);
+private:
+    struct Transform;
+
+    const Transform* transform = nullptr;
+    Tensor::Size inputSize;
+    Tensor::Size outputSize;
+    int kernel_num = 0;
+    int padding = 0;
+    int tilesY = 0;
+    int tilesX = 0;
+    // transformed kernels, alpha^2 x kernel_num x depth
+    Mat U;
+    // transformed input tiles, alpha^2 x depth x tiles
+    Mat V;
+    // products before the output transform, alpha^2 x kernel_num x tiles
+    Mat M;
+};
+
+// Checks every tile size against the direct Conv() reference, logs the error per variant
+bool WinogradSelfTest(std::ostream& log);
@@ -0,0 +1,25 @@
+#include "Workspace.h"
+#include <cassert>
+
+int Workspace::roundUp(int count)
+{
+    const int line = 64 / sizeof(Scalar);
+    return (count + line - 1) / line * line;
+}
+
+void Workspace::reserve(int count)
+{
+    if (count > capacity()) {
+        block.resize(count);
+    }
+    used = 0;
+}
+
+Scalar* Workspace::allocate(int count)
+{
+    const int size = roundUp(count);
+    assert(used + size <= capacity() && "workspace was not reserved for this batch size");
+    Scalar* buffer = block.data() + used;
+    used += size;
+    return buffer;
+}
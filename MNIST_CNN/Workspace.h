@@ -0,0 +1,21 @@
+#pragma once
+#include "Tensor.h"
+
+// Bump allocator for temporaries that live for one backward pass. The Net reserves it
+// once from the layers' getWorkspaceSize and resets it at every step, so carving a
+// buffer out of it never touches the heap.
+class Workspace
+{
+public:
+    // allocate() hands out whole cache lines, sizes have to be rounded the same way
+    static int roundUp(int count);
+
+    // Grows the block to at least count scalars and releases every handed out buffer
+    void reserve(int count);
+    Scalar* allocate(int count);
+    void reset() { used = 0; }
+    int capacity() const { return block.size(); }
+private:
+    AlignedMat block;
+    int used = 0;
+};
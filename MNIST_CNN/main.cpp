@@ -1,33 +1,155 @@
 #include <iostream>
+#include <thread>
+#include <algorithm>
+#include <string>
+#include <random>
+#include <sstream>
+#include <csignal>
+#include "InferenceServer.h"
 #include "MNIST.h"
 #include "Net.h"
+#include "Profiler.h"
+#include "Simd.h"
+#include "Winograd.h"
 
-int main()
+namespace {
+    InferenceServer* server = nullptr;
+
+    void StopServer(int)
+    {
+        server->stop();
+    }
+}
+
+int main(int argc, char** argv)
 {
+    const std::string mode = argc > 1 ? argv[1] : "";
+    if (mode == "--selftest") {
+        const bool simd = SimdSelfTest(std::cout);
+        const bool winograd = WinogradSelfTest(std::cout);
+        const bool conv = Conv2dSelfTest(std::cout);
+        const bool convPool = ConvPool2dSelfTest(std::cout);
+        const bool maxpool = Maxpool2dSelfTest(std::cout);
+        const bool checkpoint = CheckpointSelfTest(std::cout);
+        const bool writer = CheckpointWriterSelfTest(std::cout);
+        return (simd && winograd && conv && convPool && maxpool && checkpoint && writer) ? 0 : 1;
+    }
+    if (mode == "--serve") {
+        // classify for other processes: --serve [socket path, or - for stdin/stdout] [checkpoint]
+        const std::string endpoint = argc > 2 ? argv[2] : "mnist_cnn.sock";
+        const Model model(argc > 3 ? argv[3] : "mnist_cnn.ckpt");
+        InferenceServer::Options options;
+        options.threads = std::max(1u, std::thread::hardware_concurrency());
+        InferenceServer inference(model, options);
+        server = &inference;
+        std::signal(SIGINT, StopServer);
+        std::signal(SIGTERM, StopServer);
+#ifdef SIGPIPE
+        // a client that hangs up mid-answer must not take the server down
+        std::signal(SIGPIPE, SIG_IGN);
+#endif
+        if (endpoint == "-") {
+            inference.serveStream(0, 1);
+        }
+        else {
+            std::cerr << "serving on " << endpoint << std::endl;
+            inference.serveSocket(endpoint);
+        }
+        const InferenceServer::Stats stats = inference.getStats();
+        std::cerr << stats.requests << " requests in " << stats.batches << " batches, p50 " << stats.p50_us
+            << " us, p99 " << stats.p99_us << " us, " << stats.requests_per_sec << " requests/sec" << std::endl;
+        return 0;
+    }
+
     srand(time(0));
 
-    auto labeled_2d = MNIST::Get().GetLabeledImages();
-    std::pair<MNIST::LabeledSamples, MNIST::LabeledSamples> train_test = MNIST::Get().GetTrainTestSamples();
+    std::pair<DatasetView, DatasetView> train_test = MNIST::Get().GetTrainTestSplit();
+    const std::string checkpoint = "mnist_cnn.ckpt";
+    if (mode == "--test") {
+        // evaluate the last trained network without retraining
+        Net net(argc > 2 ? argv[2] : checkpoint);
+        std::cout << net.test(train_test.second, 64, std::max(1u, std::thread::hardware_concurrency()));
+        return 0;
+    }
 
-    MNIST::LabeledSamples train = train_test.first;
-    MNIST::LabeledSamples test = train_test.second;
+    DatasetView& train = train_test.first;
+    const DatasetView& test = train_test.second;
+    std::mt19937 rng(time(0));
+    auto hasFlag = [&](const std::string& flag) { return std::find(argv + 1, argv + argc, flag) != argv + argc; };
 
-    Net net (
-        {
-            { "Conv2d", {28,28,1}, 5, 1, 16, 0, EActivation::ReLU},
-            { "Maxpool", {24,24,16}, 2},
-            { "Conv2d", {12,12,16}, 5, 1, 32, 0, EActivation::ReLU},
-            { "Maxpool", {8,8,32}, 2}
+    std::unique_ptr<Net> net;
+    TrainProgress progress;
+    if (hasFlag("--resume")) {
+        // continue a stopped run from its last checkpoint, on the same sample order
+        net = std::make_unique<Net>(checkpoint);
+        progress = net->getProgress();
+        if (!progress.rng.empty()) {
+            std::istringstream(progress.rng) >> rng;
+        }
+        // the saved order has to be a permutation of this split's samples; one from another
+        // dataset or split starts the epoch over on a fresh shuffle
+        std::vector<int> saved = progress.order;
+        std::vector<int> current = train.getIndices();
+        std::sort(saved.begin(), saved.end());
+        std::sort(current.begin(), current.end());
+        if (saved == current) {
+            train = DatasetView(train.getDataset(), progress.order);
+        }
+        else {
+            progress.sample = 0;
+        }
+        if (progress.sample >= train.size()) {
+            ++progress.epoch;
+            progress.sample = 0;
+        }
+        std::cout << "resuming at epoch " << progress.epoch << ", sample " << progress.sample << std::endl;
+    }
+    else {
+        net = std::make_unique<Net>(
+            std::vector<Layer2d::Topology>{
+                { "Conv2d", {28,28,1}, 5, 1, 16, 0, EActivation::ReLU},
+                { "Maxpool", {24,24,16}, 2, 2, 16, 0, EActivation::ReLU},
+                { "Conv2d", {12,12,16}, 5, 1, 32, 0, EActivation::ReLU},
+                { "Maxpool", {8,8,32}, 2, 2, 32, 0, EActivation::ReLU}
 
-        },
-        {
-            {"Softmax", 4*4*32, 10}
+            },
+            std::vector<Layer::Topology>{
+                {"Softmax", 4*4*32, 10, EActivation::ReLU}
+            }
+        );
+    }
+    const int threads = std::max(1u, std::thread::hardware_concurrency());
+    if (hasFlag("--augment")) {
+        // fresh distortions of the samples every epoch, prepared on a few background threads
+        Augmenter::Options augmentation;
+        augmentation.elastic_alpha = 34;
+        net->augment(augmentation);
+        net->setInputThreads(std::max(1, threads / 2));
+    }
+    // written in the background, the last one holds the trained network
+    net->checkpointEvery(checkpoint, 10000);
+
+    const bool hogwild = hasFlag("--hogwild");
+    for (; progress.epoch < 15; ++progress.epoch) {
+        if (progress.sample == 0) {
+            train.shuffle(rng);
         }
-    );
+        std::ostringstream rngState;
+        rngState << rng;
+        progress.rng = rngState.str();
 
-    for (int epoch = 0; epoch < 15; ++epoch) {
-        net.train(train, 0.05);
+        Net::TrainStats stats = hogwild ?
+            net->train(train, 0.05, 4, threads, ETrainMode::Hogwild, &progress) :
+            net->train(train, 0.1, 32, threads, ETrainMode::Synchronous, &progress);
+        std::cout << "epoch " << progress.epoch << (hogwild ? " (hogwild): " : " (synchronous): ")
+            << stats.images_per_sec << " images/sec, accuracy " << stats.accuracy
+            << ", " << stats.allocations << " heap allocations, " << stats.input_stalls << " input stalls" << std::endl;
+        progress.sample = 0;
     }
-    net.test(test);
+    std::cout << net->test(test, 64, threads);
+#ifdef MNIST_CNN_PROFILE
+    Profiler::PrintSummary(std::cout);
+    Profiler::WriteChromeTrace("mnist_cnn_trace.json");
+    std::cout << "trace written to mnist_cnn_trace.json" << std::endl;
+#endif
 }
-
@@ -0,0 +1,394 @@
+// Microbenchmarks of the math kernels, every layer type and the whole network over a grid of
+// shapes. Prints a table, or with --json a document to keep next to a commit and compare.
+//
+//   mnist_cnn_bench [--json] [--filter text] [--min-time seconds]
+#include "LayerStack.h"
+#include "Simd.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+    struct Result {
+        std::string name;
+        std::string shape;
+        double ns_per_op;
+        // 0 where the operation does no arithmetic worth counting
+        double flops;
+        // bytes the operation has to read and write at least, caches aside
+        double bytes;
+    };
+
+    struct Options {
+        bool json = false;
+        std::string filter;
+        double min_time = 0.02;
+    };
+
+    std::mt19937 gen(1);
+
+    void Randomize(Scalar* data, int count)
+    {
+        std::uniform_real_distribution<Scalar> dist(-1, 1);
+        for (int i = 0; i < count; ++i) {
+            data[i] = dist(gen);
+        }
+    }
+
+    std::string Shape(const Tensor::Size& size)
+    {
+        std::ostringstream shape;
+        shape << size.batch << "x" << size.depth << "x" << size.height << "x" << size.width;
+        return shape.str();
+    }
+
+    // Nanoseconds per call, the best of a few runs that each repeat the call for min_time
+    double TimePerCall(const std::function<void()>& func, double min_time)
+    {
+        typedef std::chrono::steady_clock Clock;
+        func();
+        double best = std::numeric_limits<double>::max();
+        for (int run = 0; run < 3; ++run) {
+            const Clock::time_point start = Clock::now();
+            int calls = 0;
+            std::chrono::duration<double> elapsed;
+            do {
+                func();
+                ++calls;
+                elapsed = Clock::now() - start;
+            } while (elapsed.count() < min_time);
+            best = std::min(best, elapsed.count() / calls);
+        }
+        return best * 1e9;
+    }
+
+    class Suite
+    {
+    public:
+        explicit Suite(const Options& options) : options(options) {}
+
+        void run(const std::string& name, const std::string& shape, double flops, double bytes,
+            const std::function<void()>& func)
+        {
+            if (!options.filter.empty() && (name + " " + shape).find(options.filter) == std::string::npos) {
+                return;
+            }
+            results.push_back({ name, shape, TimePerCall(func, options.min_time), flops, bytes });
+            if (!options.json) {
+                const Result& r = results.back();
+                std::cout << std::left << std::setw(28) << r.name << std::setw(22) << r.shape << std::right
+                    << std::fixed << std::setprecision(0) << std::setw(14) << r.ns_per_op << " ns"
+                    << std::setprecision(2) << std::setw(10) << r.flops / r.ns_per_op << " GFLOP/s"
+                    << std::setw(10) << r.bytes / r.ns_per_op << " GB/s" << std::endl;
+            }
+        }
+
+        void printJson(std::ostream& out) const
+        {
+            out << "{\n  \"cpu\": \"" << Escape(CpuModel()) << "\",\n  \"simd\": \"" << Simd().name
+                << "\",\n  \"scalar\": \"" << (sizeof(Scalar) == sizeof(float) ? "float" : "double")
+                << "\",\n  \"results\": [";
+            for (size_t i = 0; i < results.size(); ++i) {
+                const Result& r = results[i];
+                out << (i ? ",\n" : "\n") << "    {\"name\": \"" << r.name << "\", \"shape\": \"" << r.shape
+                    << "\", \"ns_per_op\": " << r.ns_per_op << ", \"gflops\": " << r.flops / r.ns_per_op
+                    << ", \"gbytes_per_sec\": " << r.bytes / r.ns_per_op << "}";
+            }
+            out << "\n  ]\n}" << std::endl;
+        }
+    private:
+        static std::string Escape(const std::string& text)
+        {
+            std::string escaped;
+            for (char c : text) {
+                if (c == '"' || c == '\\') {
+                    escaped += '\\';
+                }
+                escaped += c;
+            }
+            return escaped;
+        }
+    private:
+        Options options;
+        std::vector<Result> results;
+    };
+
+    struct ConvShape {
+        Tensor::Size input;
+        int kernel_dim;
+        int kernel_num;
+        int stride;
+        int padding;
+    };
+
+    // The two convolutions of the MNIST network and a padded 3x3 one for the Winograd paths
+    const ConvShape CONV_SHAPES[] = {
+        { {28, 28, 1}, 5, 16, 1, 0 },
+        { {12, 12, 16}, 5, 32, 1, 0 },
+        { {14, 14, 16}, 3, 16, 1, 1 },
+    };
+    const int BATCHES[] = { 1, 32 };
+
+    int ConvOut(int in, const ConvShape& s)
+    {
+        return (in + 2 * s.padding - s.kernel_dim) / s.stride + 1;
+    }
+
+    void BenchKernels(Suite& suite)
+    {
+        for (const ConvShape& s : CONV_SHAPES) {
+            Tensor img(s.input);
+            Tensor kernel(s.kernel_dim, s.kernel_dim, s.input.depth);
+            Randomize(img.data(), img.getRawSize());
+            Randomize(kernel.data(), kernel.getRawSize());
+            const int outArea = ConvOut(s.input.height, s) * ConvOut(s.input.width, s);
+            Mat out(outArea);
+            std::ostringstream shape;
+            shape << Shape(s.input) << " k" << s.kernel_dim;
+            const double flops = 2.0 * outArea * s.kernel_dim * s.kernel_dim * s.input.depth;
+            const double bytes = double(img.getRawSize() + kernel.getRawSize() + outArea) * sizeof(Scalar);
+
+            suite.run("Conv", shape.str(), flops, bytes, [&] { Conv(img, kernel, s.stride, s.padding, out.data()); });
+            // the backward pass convolves with rotated kernels through a view, no copy
+            const TensorView rotated = TensorView(kernel).rotated180();
+            suite.run("Conv rotated180", shape.str(), flops, bytes, [&] { Conv(img, rotated, s.stride, s.padding, out.data()); });
+        }
+
+        for (const ConvShape& s : CONV_SHAPES) {
+            Tensor kernels(s.kernel_dim, s.kernel_dim, s.input.depth * s.kernel_num);
+            Randomize(kernels.data(), kernels.getRawSize());
+            Tensor copy(kernels.getSize());
+            const double bytes = 2.0 * kernels.getRawSize() * sizeof(Scalar);
+            suite.run("rotated180 copy", Shape(kernels.getSize()), 0, bytes, [&] {
+                const TensorView rotated = TensorView(kernels).rotated180();
+                Scalar* out = copy.data();
+                for (int d = 0; d < rotated.depth(); ++d) {
+                    for (int i = 0; i < rotated.height(); ++i) {
+                        for (int j = 0; j < rotated.width(); ++j) {
+                            *out++ = rotated(i, j, d);
+                        }
+                    }
+                }
+            });
+        }
+
+        for (int batch : BATCHES) {
+            Tensor tensor(4, 4, 32, batch);
+            Randomize(tensor.data(), tensor.getRawSize());
+            Mat flat;
+            const double bytes = 2.0 * tensor.getRawSize() * sizeof(Scalar);
+            suite.run("Flatten", Shape(tensor.getSize()), 0, bytes, [&] { flat = Flatten(tensor); });
+        }
+    }
+
+    // Parameters, gradients and workspace of one layer under test
+    struct Storage {
+        Mat params;
+        Mat grads;
+        Workspace workspace;
+    };
+
+    template <typename LayerT>
+    void Bind(LayerT& layer, Storage& storage, int batch)
+    {
+        storage.params.resize(layer.getParamCount());
+        storage.grads.resize(layer.getParamCount());
+        layer.bindParams(storage.params.data(), storage.grads.data());
+        layer.initParams();
+        storage.workspace.reserve(layer.getWorkspaceSize(batch));
+        layer.bindWorkspace(&storage.workspace);
+    }
+
+    void BenchLayers2d(Suite& suite)
+    {
+        const EConvAlgorithm algorithms[] = { EConvAlgorithm::Direct, EConvAlgorithm::Im2col, EConvAlgorithm::Winograd };
+        for (const ConvShape& s : CONV_SHAPES) {
+            for (int batch : BATCHES) {
+                Conv2d conv(s.input, EActivation::ReLU, s.kernel_num, s.stride, s.padding, s.kernel_dim);
+                Storage storage;
+                Bind(conv, storage, batch);
+                Tensor::Size inSize = s.input;
+                inSize.batch = batch;
+                Tensor input(inSize);
+                Randomize(input.data(), input.getRawSize());
+                Tensor::Size outSize = conv.getOutputSize();
+                outSize.batch = batch;
+                Tensor dL_dA(outSize);
+                Randomize(dL_dA.data(), dL_dA.getRawSize());
+
+                std::ostringstream shape;
+                shape << Shape(inSize) << " " << s.kernel_num << "k" << s.kernel_dim;
+                const double macs = double(batch) * outSize.height * outSize.width * s.kernel_num
+                    * s.kernel_dim * s.kernel_dim * s.input.depth;
+                const double kernelBytes = double(conv.getParamCount()) * sizeof(Scalar);
+                const double ioBytes = double(input.getRawSize() + dL_dA.getRawSize()) * sizeof(Scalar);
+
+                for (EConvAlgorithm algorithm : algorithms) {
+                    // the other pass stays on Direct, which shares nothing with either
+                    if (conv.supportsForward(algorithm)) {
+                        conv.setAlgorithms(algorithm, EConvAlgorithm::Direct);
+                        suite.run(std::string("Conv2d.forward/") + ToString(algorithm), shape.str(), 2 * macs,
+                            ioBytes + kernelBytes, [&] { conv.feedForward(input); });
+                    }
+                    if (conv.supportsBackward(algorithm)) {
+                        conv.setAlgorithms(EConvAlgorithm::Direct, algorithm);
+                        conv.feedForward(input);
+                        // gradients of the kernels and of the input
+                        suite.run(std::string("Conv2d.backward/") + ToString(algorithm), shape.str(), 4 * macs,
+                            2 * ioBytes + 2 * kernelBytes, [&] {
+                                storage.workspace.reset();
+                                conv.backProp(dL_dA);
+                            });
+                    }
+                }
+            }
+        }
+
+        const Tensor::Size poolShapes[] = { {24, 24, 16}, {8, 8, 32} };
+        for (const Tensor::Size& s : poolShapes) {
+            for (int batch : BATCHES) {
+                Maxpool2d pool(s, 2);
+                Storage storage;
+                Bind(pool, storage, batch);
+                Tensor::Size inSize = s;
+                inSize.batch = batch;
+                Tensor input(inSize);
+                Randomize(input.data(), input.getRawSize());
+                Tensor::Size outSize = pool.getOutputSize();
+                outSize.batch = batch;
+                Tensor dL_dA(outSize);
+                Randomize(dL_dA.data(), dL_dA.getRawSize());
+
+                const double bytes = double(input.getRawSize() + dL_dA.getRawSize()) * sizeof(Scalar);
+                // one comparison per input element
+                suite.run("Maxpool2d.forward", Shape(inSize), input.getRawSize(), bytes, [&] { pool.feedForward(input); });
+                pool.feedForward(input);
+                suite.run("Maxpool2d.backward", Shape(inSize), 0, bytes, [&] {
+                    storage.workspace.reset();
+                    pool.backProp(dL_dA);
+                });
+            }
+        }
+    }
+
+    template <typename LayerT>
+    void BenchLayer(Suite& suite, const std::string& name, LayerT& layer, int batch)
+    {
+        Storage storage;
+        Bind(layer, storage, batch);
+        const int in = layer.getInputSize();
+        const int out = layer.getOutputSize();
+        Mat input(batch * in);
+        Randomize(input.data(), input.size());
+        Mat dL_dA(batch * out, 0);
+        for (int n = 0; n < batch; ++n) {
+            // a one-hot row also stands for the expected scores of the Softmax layer
+            dL_dA[n * out + n % out] = 1;
+        }
+
+        std::ostringstream shape;
+        shape << batch << "x" << in << " -> " << out;
+        const double macs = double(batch) * in * out;
+        const double bytes = (double(in) * out + 2.0 * batch * (in + out)) * sizeof(Scalar);
+        suite.run(name + ".forward", shape.str(), 2 * macs, bytes, [&] { layer.feedForward(input.data(), batch); });
+        layer.feedForward(input.data(), batch);
+        suite.run(name + ".backward", shape.str(), 4 * macs, 2 * bytes, [&] {
+            storage.workspace.reset();
+            layer.backProp(dL_dA);
+        });
+    }
+
+    void BenchLayers(Suite& suite)
+    {
+        for (int batch : BATCHES) {
+            DenseLayer dense(4 * 4 * 32, 128, EActivation::ReLU);
+            BenchLayer(suite, "DenseLayer", dense, batch);
+            SoftmaxLayer softmax(4 * 4 * 32, 10);
+            BenchLayer(suite, "SoftmaxLayer", softmax, batch);
+        }
+    }
+
+    void BenchNetwork(Suite& suite)
+    {
+        // the network main.cpp trains
+        const std::vector<Layer2d::Topology> topology2d = {
+            { "Conv2d", {28,28,1}, 5, 1, 16, 0, EActivation::ReLU},
+            { "Maxpool", {24,24,16}, 2, 2, 16, 0, EActivation::ReLU},
+            { "Conv2d", {12,12,16}, 5, 1, 32, 0, EActivation::ReLU},
+            { "Maxpool", {8,8,32}, 2, 2, 32, 0, EActivation::ReLU}
+        };
+        const std::vector<Layer::Topology> topology = { {"Softmax", 4*4*32, 10, EActivation::ReLU} };
+        // multiply-adds per sample of the two convolutions and the Softmax layer
+        const double macs = 24.0 * 24 * 16 * 5 * 5 * 1 + 8.0 * 8 * 32 * 5 * 5 * 16 + 4.0 * 4 * 32 * 10;
+
+        for (int batch : BATCHES) {
+            LayerStack layers(topology2d, topology);
+            AlignedMat params(layers.getParamCount());
+            AlignedMat grads(layers.getParamCount());
+            Workspace workspace;
+            workspace.reserve(layers.getWorkspaceSize(batch));
+            layers.bind(params.data(), grads.data(), &workspace);
+            layers.initParams();
+            layers.tuneConvolutions(true);
+
+            Tensor::Size inSize = layers.getInputSize();
+            inSize.batch = batch;
+            Tensor input(inSize);
+            Randomize(input.data(), input.getRawSize());
+            Mat y(batch * layers.getClasses(), 0);
+            for (int n = 0; n < batch; ++n) {
+                y[n * layers.getClasses() + n % layers.getClasses()] = 1;
+            }
+
+            const double bytes = (double(input.getRawSize()) + params.size()) * sizeof(Scalar);
+            suite.run("Net.forward", Shape(inSize), 2 * macs * batch, bytes, [&] { layers.forward(input); });
+            layers.forward(input);
+            suite.run("Net.backprop", Shape(inSize), 4 * macs * batch, bytes + grads.size() * sizeof(Scalar), [&] {
+                workspace.reset();
+                layers.backprop(y);
+            });
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--json") == 0) {
+            options.json = true;
+        }
+        else if (std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            options.filter = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            options.min_time = std::atof(argv[++i]);
+        }
+        else {
+            std::cerr << "usage: " << argv[0] << " [--json] [--filter text] [--min-time seconds]" << std::endl;
+            return 1;
+        }
+    }
+
+    Suite suite(options);
+    if (!options.json) {
+        std::cout << CpuModel() << ", " << Simd().name << ", " << (sizeof(Scalar) == sizeof(float) ? "float" : "double") << std::endl;
+    }
+    BenchKernels(suite);
+    BenchLayers2d(suite);
+    BenchLayers(suite);
+    BenchNetwork(suite);
+    if (options.json) {
+        suite.printJson(std::cout);
+    }
+    return 0;
+}